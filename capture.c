@@ -0,0 +1,604 @@
+/*
+ * capture.c - An LD_PRELOAD shim that records the malloc, calloc,
+ *     realloc and free calls of a live process as an mdriver trace.
+ *
+ * usage: CAPTURE_FILE=<out> LD_PRELOAD=./libcapture.so <program> ...
+ *
+ * Each call is passed to the real allocator and then logged, with a
+ * sequence number from a global counter, in a ring buffer owned by the
+ * calling thread. The rings are single-producer/single-consumer and
+ * lock-free: only a full ring makes a thread wait. A background thread
+ * drains them every FLUSH_USECS, merges the events of all threads back
+ * into sequence order and writes them out, remapping block addresses
+ * to trace ids (recycling the ids of freed blocks, so num_ids stays
+ * close to the peak number of live blocks). The header is completed
+ * when the process exits.
+ *
+ * The trace goes to CAPTURE_FILE (default capture.<pid>.rep), in text
+ * .rep format unless the name ends in .bin, which selects the binary
+ * format of trace.h. Frees and reallocs of blocks allocated before the
+ * capture started are dropped, aligned allocations are recorded as plain
+ * allocs, and zero-byte requests as one-byte ones, since mdriver treats
+ * a NULL return as a failure.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define RING_SIZE   (1 << 14)  /* events per thread ring (a power of 2) */
+#define FLUSH_USECS 1000       /* how often the flusher drains the rings */
+#define BOOT_SIZE   (1 << 16)  /* bytes for allocations made by dlsym */
+
+/* One logged call; ALLOC, FREE or REALLOC as in trace.h, or NONE */
+#define NONE (-1)
+
+typedef struct {
+    unsigned long seq;  /* global order of the call */
+    void *ptr;          /* block returned (ALLOC, REALLOC) or freed */
+    void *old;          /* block passed to realloc */
+    size_t size;        /* requested size */
+    int type;
+} event_t;
+
+/* A thread's event ring, linked into the list the flusher walks */
+typedef struct ring {
+    event_t ev[RING_SIZE];
+    unsigned long head;    /* next event to drain (flusher) */
+    unsigned long tail;    /* next free slot (owning thread) */
+    int pending;           /* owner is between taking a seq and publishing */
+    struct ring *next;
+} ring_t;
+
+/* Address -> id map entry; ptr NULL is empty, DEAD a deleted entry */
+typedef struct {
+    void *ptr;
+    unsigned id;
+} slot_t;
+
+#define DEAD ((void *)1)
+
+/* The real allocator */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+
+/* Bump allocator for the calls dlsym makes before real_xxx are known */
+static char boot[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t boot_used;
+#define IN_BOOT(p) (((char *)(p) >= boot) && ((char *)(p) < boot + BOOT_SIZE))
+
+/* Capture state */
+static int started;                /* rings are being recorded */
+static int stopping;               /* no more events, the flusher quits */
+static unsigned long next_seq;     /* sequence number of the next event */
+static ring_t *rings;              /* every thread's ring */
+static pthread_t flusher;
+static FILE *out;
+static int binary;                 /* write trace.h binary, not .rep */
+static bintrace_hdr_t hdr;
+
+/* Flusher state: the address map, recycled ids and the merge buffer */
+static slot_t *map;
+static unsigned long map_cap, map_used, map_live; /* slots, not empty, live */
+static unsigned *freeids;
+static unsigned long nfree, freecap;
+static unsigned nids;
+static event_t *merge;
+static unsigned long merge_cap;
+
+/* Per-thread state; initial-exec, so touching it never calls malloc */
+static __thread ring_t *my_ring __attribute__((tls_model("initial-exec")));
+static __thread int inside __attribute__((tls_model("initial-exec")));
+
+static void record(int type, void *ptr, void *old, size_t size);
+static event_t *begin_event(void);
+static void end_event(event_t *e, int type, void *ptr, void *old, size_t size);
+static ring_t *new_ring(void);
+static void *flush_thread(void *arg);
+static void drain(void);
+static void emit_event(event_t *e);
+static void emit(int type, unsigned id, size_t size);
+static int map_find(void *ptr, unsigned *id, int remove);
+static void map_insert(void *ptr, unsigned id);
+static unsigned new_id(void);
+static int seq_order(const void *a, const void *b);
+static void *boot_alloc(size_t size);
+
+/*
+ * capture_init - find the real allocator and start the flusher
+ */
+__attribute__((constructor))
+static void capture_init(void)
+{
+    char name[64], *path;
+
+    inside = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    if (!real_malloc || !real_calloc || !real_realloc || !real_free) {
+	fprintf(stderr, "capture: can't find the real allocator\n");
+	_exit(1);
+    }
+
+    if ((path = getenv("CAPTURE_FILE")) == NULL) {
+	snprintf(name, sizeof(name), "capture.%d.rep", (int)getpid());
+	path = name;
+    }
+    binary = (strlen(path) > 4) && !strcmp(path + strlen(path) - 4, ".bin");
+    if ((out = fopen(path, "w")) == NULL) {
+	perror(path);
+	inside = 0;
+	return;
+    }
+
+    /* Leave room for the header, which we rewrite at exit */
+    hdr.magic = BT_MAGIC;
+    hdr.version = BT_VERSION;
+    hdr.weight = 1;
+    if (binary)
+	fwrite(&hdr, sizeof(hdr), 1, out);
+    else
+	fprintf(out, "%10d\n%10d\n%10d\n%10d\n", 0, 0, 0, 0);
+
+    if (pthread_create(&flusher, NULL, flush_thread, NULL) != 0) {
+	fprintf(stderr, "capture: can't start the flusher thread\n");
+	fclose(out);
+	out = NULL;
+	inside = 0;
+	return;
+    }
+    __atomic_store_n(&started, 1, __ATOMIC_RELEASE);
+    inside = 0;
+}
+
+/*
+ * capture_fini - stop recording, write out what's left and finish the
+ *     header
+ */
+__attribute__((destructor))
+static void capture_fini(void)
+{
+    if (!__atomic_load_n(&started, __ATOMIC_ACQUIRE))
+	return;
+    inside = 1;
+    __atomic_store_n(&started, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(flusher, NULL);
+    drain();
+
+    hdr.num_ids = nids;
+    hdr.sugg_heapsize = 0;
+    rewind(out);
+    if (binary)
+	fwrite(&hdr, sizeof(hdr), 1, out);
+    else
+	fprintf(out, "%10d\n%10d\n%10d\n%10d\n", hdr.sugg_heapsize,
+		hdr.num_ids, hdr.num_ops, hdr.weight);
+    fclose(out);
+}
+
+/*
+ * The interposed calls: each calls the real one and logs the result
+ */
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (!real_malloc)
+	return boot_alloc(size);
+    p = real_malloc(size);
+    if (p != NULL)
+	record(ALLOC, p, NULL, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (!real_calloc)
+	return boot_alloc(nmemb * size);  /* boot is zeroed */
+    p = real_calloc(nmemb, size);
+    if (p != NULL)
+	record(ALLOC, p, NULL, nmemb * size);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    event_t *e;
+    size_t n;
+    void *p;
+
+    if (!real_realloc || IN_BOOT(ptr)) {
+	if (((p = malloc(size)) != NULL) && (ptr != NULL)) {
+	    n = boot + BOOT_SIZE - (char *)ptr;  /* boot block sizes aren't kept */
+	    memcpy(p, ptr, (size < n) ? size : n);
+	}
+	return p;
+    }
+
+    /* 
+     * Number the call before making it: once the old block is freed, 
+     * another thread may get its address and log that first.
+     */
+    e = begin_event();
+    p = real_realloc(ptr, size);
+    if ((p != NULL) || (size == 0))
+	end_event(e, REALLOC, p, ptr, size);
+    else
+	end_event(e, NONE, NULL, NULL, 0);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if ((ptr == NULL) || IN_BOOT(ptr))
+	return;
+    record(FREE, ptr, NULL, 0);
+    real_free(ptr);
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size)
+{
+    int err;
+
+    if (!real_posix_memalign)
+	return ENOMEM;
+    if ((err = real_posix_memalign(ptr, align, size)) == 0)
+	record(ALLOC, *ptr, NULL, size);
+    return err;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    void *p;
+
+    if (!real_aligned_alloc)
+	return NULL;
+    if ((p = real_aligned_alloc(align, size)) != NULL)
+	record(ALLOC, p, NULL, size);
+    return p;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p;
+
+    if (!real_memalign)
+	return NULL;
+    if ((p = real_memalign(align, size)) != NULL)
+	record(ALLOC, p, NULL, size);
+    return p;
+}
+
+/*
+ * record - log one call in the calling thread's ring
+ *     The free is logged before the block is really freed, so the
+ *     address can't be handed out again, and logged, ahead of it.
+ */
+static void record(int type, void *ptr, void *old, size_t size)
+{
+    end_event(begin_event(), type, ptr, old, size);
+}
+
+/*
+ * begin_event - take the next slot of the calling thread's ring and a
+ *     sequence number for it, or return NULL if the call isn't traced
+ *     The flusher waits for the thread until end_event publishes the
+ *     event, so the thread waits for room in its ring first.
+ */
+static event_t *begin_event(void)
+{
+    ring_t *r;
+    event_t *e;
+    unsigned long tail;
+
+    if (inside || !__atomic_load_n(&started, __ATOMIC_ACQUIRE))
+	return NULL;
+    if (((r = my_ring) == NULL) && ((r = my_ring = new_ring()) == NULL))
+	return NULL;
+
+    tail = r->tail;
+    while (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == RING_SIZE)
+	sched_yield();
+
+    __atomic_store_n(&r->pending, 1, __ATOMIC_SEQ_CST);
+    e = &r->ev[tail & (RING_SIZE - 1)];
+    e->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_SEQ_CST);
+    return e;
+}
+
+/*
+ * end_event - fill in and publish the event begin_event started
+ */
+static void end_event(event_t *e, int type, void *ptr, void *old, size_t size)
+{
+    ring_t *r = my_ring;
+
+    if (e == NULL)
+	return;
+    e->type = type;
+    e->ptr = ptr;
+    e->old = old;
+    e->size = size;
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->pending, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * new_ring - make the calling thread's ring and link it in for the flusher
+ */
+static ring_t *new_ring(void)
+{
+    ring_t *r;
+
+    inside = 1;
+    r = real_calloc(1, sizeof(ring_t));
+    inside = 0;
+    if (r == NULL)
+	return NULL;
+    r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	;
+    return r;
+}
+
+/*
+ * flush_thread - drain the rings every FLUSH_USECS until capture stops
+ */
+static void *flush_thread(void *arg)
+{
+    struct timespec ts = {0, FLUSH_USECS * 1000};
+
+    inside = 1;  /* this thread's own allocations aren't traced */
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+	nanosleep(&ts, NULL);
+	drain();
+    }
+    return arg;
+}
+
+/*
+ * drain - write out every event before the current sequence number
+ *     Once no thread is pending, every event numbered below the counter
+ *     has been published, and each ring holds its events in order, so
+ *     taking those events from all rings and sorting them gives a gap
+ *     free prefix of the global order.
+ */
+static void drain(void)
+{
+    unsigned long limit = __atomic_load_n(&next_seq, __ATOMIC_SEQ_CST);
+    unsigned long n = 0, head, tail, i;
+    ring_t *r;
+
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+	while (__atomic_load_n(&r->pending, __ATOMIC_SEQ_CST))
+	    sched_yield();
+	head = r->head;
+	tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	for (; (head != tail) && (r->ev[head & (RING_SIZE - 1)].seq < limit); head++) {
+	    if (n == merge_cap) {
+		merge_cap = merge_cap ? 2*merge_cap : RING_SIZE;
+		if ((merge = real_realloc(merge, merge_cap * sizeof(event_t))) == NULL) {
+		    fprintf(stderr, "capture: out of memory\n");
+		    _exit(1);
+		}
+	    }
+	    merge[n++] = r->ev[head & (RING_SIZE - 1)];
+	}
+	__atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+    }
+
+    qsort(merge, n, sizeof(event_t), seq_order);
+    for (i = 0; i < n; i++)
+	emit_event(&merge[i]);
+    fflush(out);
+}
+
+/*
+ * emit_event - turn one call into trace ops, remapping addresses to ids
+ */
+static void emit_event(event_t *e)
+{
+    unsigned id, id2;
+
+    switch (e->type) {
+    case NONE:
+	break;
+    case ALLOC:
+	if (map_find(e->ptr, &id, 1)) {  /* its free went untraced */
+	    emit(FREE, id, 0);
+	    freeids[nfree++] = id;
+	}
+	id = new_id();
+	map_insert(e->ptr, id);
+	emit(ALLOC, id, e->size);
+	break;
+    case FREE:
+	if (map_find(e->ptr, &id, 1)) {
+	    emit(FREE, id, 0);
+	    freeids[nfree++] = id;
+	}
+	break;
+    default:  /* REALLOC */
+	if ((e->old == NULL) || !map_find(e->old, &id, 1)) {
+	    if (e->ptr == NULL)
+		break;
+	    id = new_id();  /* an untraced block, so this is its first sighting */
+	    map_insert(e->ptr, id);
+	    emit(ALLOC, id, e->size);
+	}
+	else if (e->size == 0) {  /* realloc(p, 0) frees p */
+	    emit(FREE, id, 0);
+	    freeids[nfree++] = id;
+	}
+	else {
+	    if ((e->ptr != e->old) && map_find(e->ptr, &id2, 1)) {
+		emit(FREE, id2, 0);
+		freeids[nfree++] = id2;
+	    }
+	    map_insert(e->ptr, id);
+	    emit(REALLOC, id, e->size);
+	}
+    }
+}
+
+/*
+ * emit - append one op to the trace
+ */
+static void emit(int type, unsigned id, size_t size)
+{
+    traceop_t op;
+
+    if (size == 0)
+	size = 1;
+    if (size > INT_MAX)
+	size = INT_MAX;
+    hdr.num_ops++;
+    if (!binary) {
+	if (type == FREE)
+	    fprintf(out, "f %u\n", id);
+	else
+	    fprintf(out, "%c %u %zu\n", (type == ALLOC) ? 'a' : 'r', id, size);
+	return;
+    }
+    memset(&op, 0, sizeof(op));
+    op.type = type;
+    op.index = id;
+    op.size = size;
+    fwrite(&op, sizeof(op), 1, out);
+    hdr.oplen += sizeof(op);
+}
+
+/*
+ * new_id - a trace id for a new block, recycling a freed one if any
+ */
+static unsigned new_id(void)
+{
+    if (nfree > 0)
+	return freeids[--nfree];
+    if (nids == freecap) {  /* the free stack may have to hold every id */
+	freecap = freecap ? 2*freecap : 1024;
+	if ((freeids = real_realloc(freeids, freecap * sizeof(unsigned))) == NULL) {
+	    fprintf(stderr, "capture: out of memory\n");
+	    _exit(1);
+	}
+    }
+    return nids++;
+}
+
+/*
+ * hash - slot index of ptr in a map of cap (a power of 2) slots
+ */
+static unsigned long hash(void *ptr, unsigned long cap)
+{
+    return ((((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ull) >> 32) & (cap - 1);
+}
+
+/*
+ * map_find - look ptr up in the address map, setting *id; with remove,
+ *     delete it too. Returns 0 if ptr isn't there.
+ */
+static int map_find(void *ptr, unsigned *id, int remove)
+{
+    unsigned long i;
+
+    if (map_cap == 0)
+	return 0;
+    for (i = hash(ptr, map_cap); map[i].ptr != NULL; i = (i + 1) & (map_cap - 1))
+	if (map[i].ptr == ptr) {
+	    *id = map[i].id;
+	    if (remove) {
+		map[i].ptr = DEAD;
+		map_live--;
+	    }
+	    return 1;
+	}
+    return 0;
+}
+
+/*
+ * map_insert - add ptr -> id to the address map
+ *     Deleted entries still count towards the load, so once half the
+ *     slots are in use the live entries are rehashed into a map that
+ *     they fill a quarter of at most.
+ */
+static void map_insert(void *ptr, unsigned id)
+{
+    slot_t *old = map;
+    unsigned long i, j, cap = map_cap;
+
+    if (2*(map_used + 1) > map_cap) {
+	for (map_cap = 4096; map_cap < 4*(map_live + 1); map_cap *= 2)
+	    ;
+	if ((map = real_calloc(map_cap, sizeof(slot_t))) == NULL) {
+	    fprintf(stderr, "capture: out of memory\n");
+	    _exit(1);
+	}
+	for (i = 0; i < cap; i++) {
+	    if ((old[i].ptr == NULL) || (old[i].ptr == DEAD))
+		continue;
+	    for (j = hash(old[i].ptr, map_cap); map[j].ptr != NULL; j = (j + 1) & (map_cap - 1))
+		;
+	    map[j] = old[i];
+	}
+	map_used = map_live;
+	real_free(old);
+    }
+    for (i = hash(ptr, map_cap); (map[i].ptr != NULL) && (map[i].ptr != DEAD);
+	 i = (i + 1) & (map_cap - 1))
+	;
+    if (map[i].ptr == NULL)
+	map_used++;
+    map_live++;
+    map[i].ptr = ptr;
+    map[i].id = id;
+}
+
+/*
+ * seq_order - qsort comparison of two events by sequence number
+ */
+static int seq_order(const void *a, const void *b)
+{
+    unsigned long x = ((const event_t *)a)->seq;
+    unsigned long y = ((const event_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * boot_alloc - hand out bump-allocated memory while dlsym runs
+ */
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (boot_used + size > BOOT_SIZE)
+	return NULL;
+    p = boot + boot_used;
+    boot_used += size;
+    return p;
+}
@@ -14,6 +14,12 @@
  */
 #define TRACEDIR "traces/"
 
+/*
+ * With -F <n>, the driver snapshots the heap every n ops of each trace's
+ * utilization run and appends one line per snapshot to this file.
+ */
+#define FRAGFILE "frag.dat"
+
 /*
  * This is the list of default tracefiles in TRACEDIR that the driver
  * will use for testing. Modify this if you want to add or delete
@@ -34,6 +40,22 @@
   "realloc-bal.rep",\
   "realloc2-bal.rep"
 
+/*
+ * With -X, the driver replays the scaling suite from this directory
+ * instead: traces generated by "make scaling-traces" from the tracegen
+ * presets of the same names, whose live sets grow up to millions of
+ * blocks.
+ */
+#define SCALEDIR "traces/scaling/"
+
+#define SCALING_TRACEFILES \
+  "scale-10k.bin",\
+  "scale-100k.bin",\
+  "scale-1m.bin",\
+  "scale-10m.bin",\
+  "bimodal-500k.bin",\
+  "realloc-100k.bin"
+
 /*
  * This constant gives the estimated performance of the libc malloc
  * package using our traces on some reference system, typically the
@@ -53,20 +75,46 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes (8 or 16). 64-bit builds align to 16
+ * bytes, as the system malloc does, so payloads can hold SSE/AVX data.
+ * Either can be overridden with -D.
  */
-#define ALIGNMENT 8  
+#ifndef ALIGNMENT
+#ifdef __LP64__
+#define ALIGNMENT 16
+#else
+#define ALIGNMENT 8
+#endif
+#endif
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes. The allocator addresses its heap with
+ * 32-bit offsets, so this must stay below 4 GB.
  */
+#ifndef MAX_HEAP
+#ifdef __LP64__
+#define MAX_HEAP (256*(1<<20))  /* 256 MB */
+#else
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#endif
+#endif
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
-#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
-#define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_FCYC    0  /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_ITIMER  0  /* interval timer (any Unix box) */
+#define USE_GETTOD  0  /* gettimeofday (any Unix box) */
+#define USE_SAMPLES 1  /* median of timed runs after warmup (any POSIX box) */
+
+/*
+ * With USE_SAMPLES, the number of timed and of untimed warmup runs of
+ * each trace (mdriver -n and -w), and how much slower than its
+ * baseline (mdriver -b) a trace must be, beyond the confidence
+ * intervals of both runs, to count as a regression
+ */
+#define DEFAULT_SAMPLES 10
+#define DEFAULT_WARMUP   1
+#define REGRESS_TOL   0.05
 
 #endif /* __CONFIG_H */
@@ -1,7 +1,12 @@
 /****************************
  * High-level timing wrappers
  ****************************/
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
@@ -10,6 +15,15 @@
 
 static double Mhz;  /* estimated CPU clock frequency */
 
+/* USE_SAMPLES parameters */
+static int samples = DEFAULT_SAMPLES;
+static int warmup = DEFAULT_WARMUP;
+static int cpu = -1;
+
+#if USE_SAMPLES
+static int secs_order(const void *a, const void *b);
+#endif
+
 extern int verbose; /* -v option in mdriver.c */
 
 /*
@@ -36,22 +50,106 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_SAMPLES
+    if (verbose)
+	printf("Measuring performance with the median of %d runs.\n", samples);
 #endif
 }
 
+void set_fsecs_samples(int n) { samples = n; }
+void set_fsecs_warmup(int n) { warmup = n; }
+void set_fsecs_cpu(int n) { cpu = n; }
+
 /*
  * fsecs - Return the running time of a function f (in seconds)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
+    return fsecs_stats(f, argp, NULL);
+}
+
+/*
+ * fsecs_stats - Return the running time of f (in seconds), and if
+ *     stats isn't NULL, describe how it was measured there. With
+ *     USE_SAMPLES, f first runs warmup times untimed, then samples
+ *     times timed one by one, optionally pinned to a CPU. The result
+ *     is the median run, which unlike the mean a few runs disturbed by
+ *     the rest of the system can't move.
+ */
+double fsecs_stats(fsecs_test_funct f, void *argp, fsecs_stats_t *stats)
+{
+    fsecs_stats_t st;
+#if USE_SAMPLES
+    double *secs, *dev;
+    cpu_set_t old, set;
+    int i, pinned = 0, j, k;
+
+    if (((secs = malloc(samples * sizeof(double))) == NULL) ||
+	((dev = malloc(samples * sizeof(double))) == NULL)) {
+	fprintf(stderr, "fsecs: out of memory\n");
+	exit(1);
+    }
+    if ((cpu >= 0) && (sched_getaffinity(0, sizeof(old), &old) == 0)) {
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) == 0)
+	    pinned = 1;
+	else
+	    perror("fsecs: can't pin to that CPU");
+    }
+
+    for (i = 0; i < warmup; i++)
+	f(argp);
+    ftimer_samples(f, argp, samples, secs);
+    if (pinned)
+	sched_setaffinity(0, sizeof(old), &old);
+
+    qsort(secs, samples, sizeof(double), secs_order);
+    st.n = samples;
+    st.min = secs[0];
+    st.max = secs[samples-1];
+    st.median = (secs[(samples-1)/2] + secs[samples/2]) / 2;
+    for (i = 0; i < samples; i++)
+	dev[i] = fabs(secs[i] - st.median);
+    qsort(dev, samples, sizeof(double), secs_order);
+    st.mad = (dev[(samples-1)/2] + dev[samples/2]) / 2;
+
+    /* 
+     * Distribution-free interval: the median lies between the j-th and 
+     * k-th smallest of n runs with probability ~95%, for the ranks j, k 
+     * (counting from 1) the normal approximation to Binomial(n, 1/2) gives
+     */
+    j = floor((samples - 1.96*sqrt(samples)) / 2);
+    k = ceil(1 + (samples + 1.96*sqrt(samples)) / 2);
+    st.lo = secs[(j < 1) ? 0 : j-1];
+    st.hi = secs[(k > samples) ? samples-1 : k-1];
+    free(secs);
+    free(dev);
+#else
 #if USE_FCYC
-    double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
+    st.median = fcyc(f, argp) / (Mhz*1e6);
 #elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
+    st.median = ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
+    st.median = ftimer_gettod(f, argp, 10);
 #endif 
+    st.n = 1;
+    st.mad = 0;
+    st.lo = st.hi = st.min = st.max = st.median;
+#endif
+    if (stats != NULL)
+	*stats = st;
+    return st.median;
 }
 
+#if USE_SAMPLES
+/*
+ * secs_order - qsort comparator for running times
+ */
+static int secs_order(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
 
+    return (x > y) - (x < y);
+}
+#endif
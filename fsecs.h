@@ -1,4 +1,21 @@
+
 typedef void (*fsecs_test_funct)(void *);
 
+/* What fsecs_stats measured: with USE_SAMPLES, over n timed runs */
+typedef struct {
+    int n;          /* number of timed runs (1 for the other methods) */
+    double median;  /* median running time, in seconds */
+    double mad;     /* median absolute deviation from the median */
+    double lo, hi;  /* 95% confidence interval of the median */
+    double min, max;
+} fsecs_stats_t;
+
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+double fsecs_stats(fsecs_test_funct f, void *argp, fsecs_stats_t *stats);
+
+/* USE_SAMPLES parameters: timed runs, untimed warmup runs, and the
+   CPU to pin the timed runs to (-1, the default, doesn't pin) */
+void set_fsecs_samples(int n);
+void set_fsecs_warmup(int n);
+void set_fsecs_cpu(int cpu);
@@ -7,8 +7,10 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_samples: times every run on its own, with clock_gettime
  */
 #include <stdio.h>
+#include <time.h>
 #include <sys/time.h>
 #include "ftimer.h"
 
@@ -52,6 +54,23 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
     return (1E-3*diff);
 }
 
+/* 
+ * ftimer_samples - Use the monotonic clock to time each of n runs of
+ * f(argp) on its own, so the caller can see how much they vary.
+ */
+void ftimer_samples(ftimer_test_funct f, void *argp, int n, double *secs)
+{
+    int i;
+    struct timespec stv, etv;
+
+    for (i = 0; i < n; i++) {
+	clock_gettime(CLOCK_MONOTONIC, &stv);
+	f(argp);
+	clock_gettime(CLOCK_MONOTONIC, &etv);
+	secs[i] = (etv.tv_sec - stv.tv_sec) + 1E-9*(etv.tv_nsec - stv.tv_nsec);
+    }
+}
+
 
 /*
  * Routines for manipulating the Unix interval timer
@@ -12,3 +12,7 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+
+/* Time each of n runs of f(argp) separately with the monotonic clock,
+   storing the running time of run i (in seconds) in secs[i] */
+void ftimer_samples(ftimer_test_funct f, void *argp, int n, double *secs);
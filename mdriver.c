@@ -15,11 +15,20 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "perfctr.h"
+#include "clock.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -29,27 +38,67 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define STREAM_BATCH 65536 /* ops per buffer when streaming a trace (-S) */
+#define NO_ID      (~0u) /* empty entry in a stream's id table */
+#define BATCH_MAX    1024 /* most ops replayed by one batch call (-B) */
+
+/* Latency histograms (-L): 16 linear buckets per power of two of cycles */
+#define LAT_SUB_BITS 4
+#define LAT_SUB      (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS  ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+#define LAT_ALL      3   /* histogram of all ops, after ALLOC, FREE, REALLOC */
+#define LAT_TYPES    4
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, as a node of a treap */
 typedef struct range_t {
-    char *lo;              /* low payload address */
+    char *lo;              /* low payload address (the search key) */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    int prio;              /* random heap priority of the node */
+    struct range_t *left;  /* ranges with lower addresses */
+    struct range_t *right; /* ranges with higher addresses */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/* 
+ * Streams the ops of one trace file from a background reader thread
+ * through two STREAM_BATCH buffers. The reader renames each trace id to
+ * a dense slot, recycled when the block is freed, using a hash table
+ * that holds only the live ids, so the block arrays stay as small as
+ * the peak number of live blocks however long the trace is.
+ */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+    FILE *fp;                 /* the trace file, positioned by the reader */
+    char path[MAXLINE];       /* its path, for error messages */
+    int binary;               /* binary (trace.h) rather than text trace? */
+    unsigned flags;           /* BT_xxx flags of a binary trace */
+    long start;               /* file offset of the first op */
+    int num_ops;              /* ops promised by the header */
+
+    /* Shared between the reader and the replay, under lock */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    traceop_t *buf[2];        /* the two op buffers... */
+    int len[2];               /* ... their op counts (-1 while being filled) */
+    int slots[2];             /* ... and the slots in use once they're replayed */
+    int stop;                 /* tells the reader to quit early */
+    pthread_t tid;            /* the reader thread */
+    int running;              /* has the reader thread not been joined? */
+    int cur;                  /* buffer being replayed, or -1 */
+
+    /* Private to the reader thread */
+    unsigned *ids;            /* id table: live trace ids... */
+    int *idslot;              /* ... and the slot each one maps to */
+    unsigned cap;             /* size of the id table (a power of 2) */
+    unsigned live;            /* number of live ids in it */
+    int *freeslots;           /* stack of recycled slots */
+    int nslots;               /* slots handed out so far */
+} tstream_t;
 
 /* Holds the information for one trace file*/
 typedef struct {
@@ -60,8 +109,23 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapped binary trace file that ops points into */
+    size_t maplen;       /* ... and its length (map is NULL if ops is malloc'd) */
+    tstream_t *stream;   /* set if the ops are streamed rather than in ops */
+    int nblocks;         /* length of blocks and block_sizes when streaming */
+    traceop_t *next;     /* the next op to replay... */
+    traceop_t *end;      /* ... and the end of the batch it's in */
 } trace_t;
 
+/* A run of like requests replayed by one mm_malloc_batch/mm_free_batch */
+typedef struct {
+    int type;                /* ALLOC or FREE */
+    int size;                /* byte size of every alloc in the run */
+    int n;                   /* number of ops in the run */
+    int index[BATCH_MAX];    /* their ids... */
+    void *ptrs[BATCH_MAX];   /* ... and their blocks */
+} batch_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -72,24 +136,77 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* A log-linear histogram of op latencies, in cycles */
+typedef struct {
+    double count[LAT_BUCKETS]; /* number of ops in each bucket */
+    double n;                  /* total number of ops */
+    double max;                /* slowest op */
+} hist_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    fsecs_stats_t timing; /* ... and how they were measured */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* defined only with -L: LAT_TYPES latency histograms */
+    hist_t *lat;
+
+    /* defined only for mm, built with MM_STATS: its counters on the trace */
+    mm_stats_t counters;
+
+    /* defined only with -H: hardware event counts of one run, or < 0 */
+    double perf[PERF_EVENTS];
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* What a worker process (-J) found out about its trace */
+typedef struct {
+    double ops;      /* number of ops in the trace */
+    int valid;       /* was it processed correctly? */
+    double util;     /* space utilization, if valid */
+    mm_stats_t counters; /* mm event counters, if valid and counted */
+    int counted;     /* does mm keep event counters? */
+    int errors;      /* errors found */
+} result_t;
+
+/* Holds the params and result of one thread of a multi-threaded replay */
+typedef struct {
+    trace_t *trace;            /* trace to replay (ops are shared) */
+    char **blocks;             /* this thread's own array of block ptrs */
+    int libc;                  /* replay with libc malloc instead of mm */
+    pthread_barrier_t *start;  /* all threads start replaying together */
+    double start_secs;         /* time this thread started replaying */
+    double end_secs;           /* time this thread finished replaying */
+} mtarg_t;
+
+/* Summarizes a multi-threaded replay of one trace by some malloc package */
+typedef struct {
+    int threads;     /* number of threads, each replaying the whole trace */
+    double ops;      /* total number of ops over all threads */
+    double secs;     /* wall time from the first start to the last finish */
+    double tsecs;    /* sum of the running times of the threads */
+} mtstats_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int latency = 0; /* measure per-op latencies as well (-L) */
+static int zeroed = 0;  /* check allocs through mm_calloc instead (-C) */
+static int batched = 0; /* replay runs of like ops as batch calls (-B) */
+static int counted = 0; /* does mm keep event counters (MM_STATS)? */
+static int frag_every = 0; /* snapshot the heap every this many ops (-F) */
+static int hwcount = 0; /* count hardware events of each trace too (-H) */
+static size_t check_every = 0; /* mm_check this many blocks per op (-K) */
+static FILE *fragfile;  /* ... into this file */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -100,20 +217,40 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* ... and of the scaling suite (-X) */
+static char *scaling_tracefiles[] = {  
+    SCALING_TRACEFILES, NULL
+};
+
 
 /********************* 
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate the range index */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *find_range(range_t *ranges, char *hi);
+static void insert_range(range_t **ranges, range_t *p);
+static void rotate_left(range_t **ranges);
+static void rotate_right(range_t **ranges);
+static void free_ranges(range_t *ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void read_bintrace(trace_t *trace, int fd, char *path);
+static void unpack_ops(trace_t *trace, unsigned char *p, 
+		       unsigned char *end, char *path);
 static void free_trace(trace_t *trace);
+static trace_t *open_trace(char *tracedir, char *filename);
+static void trace_rewind(trace_t *trace);
+static traceop_t *next_batch(trace_t *trace);
+static void stream_stop(tstream_t *s);
+static void *stream_reader(void *ptr);
+static int stream_op(tstream_t *s, traceop_t *op);
+static int stream_slot(tstream_t *s, unsigned id, int remove);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -122,22 +259,402 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   mm_stats_t *counters);
 static void eval_mm_speed(void *ptr);
+static int batch_add(batch_t *b, traceop_t *op);
+static int batch_run(trace_t *trace, batch_t *b);
+static int batch_valid(trace_t *trace, int tracenum, int opnum, batch_t *b,
+		       range_t **ranges);
+static void util_batch(trace_t *trace, batch_t *b, int *total_size, 
+		       int *max_total_size);
+
+/* Routines for replaying a trace on several threads at once */
+static void eval_mt(trace_t *trace, int threads, int libc, mtstats_t *stats);
+static void eval_mm_workers(int n, char **tracefiles, 
+			    trace_t *(*load)(char *, char *), stats_t *stats, 
+			    int workers);
+static void eval_lat(trace_t *trace, int libc, stats_t *stats);
+static void frag_sample(int tracenum, int opnum, int payload);
+static int lat_bucket(double cycles);
+static double lat_percentile(hist_t *h, double q);
+static void *eval_mt_thread(void *ptr);
+static double mt_now(void);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printmtresults(int n, int m, mtstats_t *mm, mtstats_t *libc);
+static void printlatresults(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void printlat(hist_t *h);
+static void printperf(double *counts, double ops);
+static void write_json(char *path, int n, char **tracefiles, stats_t *stats,
+		       double perfindex);
+static int compare_baseline(char *path, int n, char **tracefiles, 
+			    stats_t *stats);
+static int json_number(char *line, char *key, double *val);
+static int set_backing(char *spec);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
 static void app_error(char *msg);
 
+/*
+ * next_op - Return the next op of the current pass over the trace, 
+ *     or NULL once the pass is over. Call trace_rewind to start a pass.
+ */
+static inline traceop_t *next_op(trace_t *trace)
+{
+    if (trace->next == trace->end)
+	return next_batch(trace);
+    return trace->next++;
+}
+
+/*
+ * open_trace - open a trace file for streaming (-S). Only the header
+ *     is read here; each pass over the trace (see trace_rewind) replays
+ *     the ops as a background thread reads them, in constant memory.
+ */
+static trace_t *open_trace(char *tracedir, char *filename)
+{
+    trace_t *trace;
+    tstream_t *s;
+    bintrace_hdr_t hdr;
+    int fields[4];
+
+    if (verbose > 1)
+	printf("Streaming tracefile: %s\n", filename);
+
+    if (((trace = (trace_t *)calloc(1, sizeof(trace_t))) == NULL) ||
+	((s = (tstream_t *)calloc(1, sizeof(tstream_t))) == NULL))
+	unix_error("calloc failed in open_trace");
+    trace->stream = s;
+
+    strcpy(s->path, tracedir);
+    strcat(s->path, filename);
+    if ((s->fp = fopen(s->path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in open_trace", s->path);
+	unix_error(msg);
+    }
+
+    /* Read whichever kind of header the file has */
+    if ((fread(&hdr, sizeof(hdr), 1, s->fp) == 1) && (hdr.magic == BT_MAGIC)) {
+	if (hdr.version != BT_VERSION) {
+	    sprintf(msg, "Unsupported binary trace version %u in %s", 
+		    hdr.version, s->path);
+	    app_error(msg);
+	}
+	s->binary = 1;
+	s->flags = hdr.flags;
+	trace->sugg_heapsize = hdr.sugg_heapsize;
+	trace->num_ids = hdr.num_ids;
+	trace->num_ops = hdr.num_ops;
+	trace->weight = hdr.weight;
+    }
+    else {
+	rewind(s->fp);
+	if (fscanf(s->fp, "%d %d %d %d", &fields[0], &fields[1], 
+		   &fields[2], &fields[3]) != 4) {
+	    sprintf(msg, "Bad header in tracefile %s", s->path);
+	    app_error(msg);
+	}
+	trace->sugg_heapsize = fields[0];
+	trace->num_ids = fields[1];
+	trace->num_ops = fields[2];
+	trace->weight = fields[3];
+    }
+    s->start = ftell(s->fp);
+    s->num_ops = trace->num_ops;
+
+    if (((s->buf[0] = malloc(STREAM_BATCH * sizeof(traceop_t))) == NULL) ||
+	((s->buf[1] = malloc(STREAM_BATCH * sizeof(traceop_t))) == NULL))
+	unix_error("malloc failed in open_trace");
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    return trace;
+}
+
+/*
+ * trace_rewind - start a new pass over the trace. A streamed trace
+ *     restarts its reader thread from the first op.
+ */
+static void trace_rewind(trace_t *trace)
+{
+    tstream_t *s = trace->stream;
+    unsigned i;
+
+    if (s == NULL) {
+	trace->next = trace->ops;
+	trace->end = trace->ops + trace->num_ops;
+	return;
+    }
+
+    stream_stop(s);
+    fseek(s->fp, s->start, SEEK_SET);
+    for (i = 0; i < s->cap; i++)
+	s->ids[i] = NO_ID;
+    s->live = 0;
+    s->nslots = 0;
+    s->len[0] = s->len[1] = -1;
+    s->cur = -1;
+    s->stop = 0;
+    trace->next = trace->end = NULL;
+
+    if (pthread_create(&s->tid, NULL, stream_reader, s) != 0)
+	unix_error("pthread_create failed in trace_rewind");
+    s->running = 1;
+}
+
+/*
+ * next_batch - hand the buffer the replay has finished back to the
+ *     reader, wait for the next one and return its first op (or NULL
+ *     at the end of the pass). Called by next_op when a batch runs out.
+ */
+static traceop_t *next_batch(trace_t *trace)
+{
+    tstream_t *s = trace->stream;
+    int n, slots;
+
+    if ((s == NULL) || !s->running)
+	return NULL;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->cur >= 0) {
+	s->len[s->cur] = -1;
+	pthread_cond_broadcast(&s->cond);
+    }
+    s->cur = (s->cur + 1) & 1;
+    while (s->len[s->cur] < 0)
+	pthread_cond_wait(&s->cond, &s->lock);
+    n = s->len[s->cur];
+    slots = s->slots[s->cur];
+    pthread_mutex_unlock(&s->lock);
+
+    if (n == 0) {
+	stream_stop(s);
+	return NULL;
+    }
+
+    /* Make room for every block that this batch can refer to */
+    if (slots > trace->nblocks) {
+	while (slots > trace->nblocks)
+	    trace->nblocks = trace->nblocks ? 2*trace->nblocks : 1024;
+	if (((trace->blocks = realloc(trace->blocks, 
+				      trace->nblocks * sizeof(char *))) == NULL) ||
+	    ((trace->block_sizes = realloc(trace->block_sizes, 
+					   trace->nblocks * sizeof(size_t))) == NULL))
+	    unix_error("realloc failed in next_batch");
+    }
+
+    trace->next = s->buf[s->cur] + 1;
+    trace->end = s->buf[s->cur] + n;
+    return s->buf[s->cur];
+}
+
+/*
+ * stream_stop - make the reader thread quit, if it is running, and 
+ *     wait for it
+ */
+static void stream_stop(tstream_t *s)
+{
+    if (!s->running)
+	return;
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->tid, NULL);
+    s->running = 0;
+}
+
+/*
+ * stream_reader - body of the reader thread. Fills the two buffers in
+ *     turn, each once the replay has handed it back, and ends the pass
+ *     with an empty batch.
+ */
+static void *stream_reader(void *ptr)
+{
+    tstream_t *s = (tstream_t *)ptr;
+    int k = 0, n, total = 0;
+
+    for (;;) {
+	pthread_mutex_lock(&s->lock);
+	while ((s->len[k] >= 0) && !s->stop)
+	    pthread_cond_wait(&s->cond, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+	if (s->stop)
+	    break;
+
+	/* The buffer is ours until we publish its length */
+	for (n = 0; (n < STREAM_BATCH) && stream_op(s, &s->buf[k][n]); n++)
+	    ;
+	total += n;
+	if ((n == 0) && (total != s->num_ops)) {
+	    printf("Tracefile %s has %d ops, not %d\n", 
+		   s->path, total, s->num_ops);
+	    exit(1);
+	}
+
+	pthread_mutex_lock(&s->lock);
+	s->len[k] = n;
+	s->slots[k] = s->nslots;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	if (n == 0)
+	    break;
+	k ^= 1;
+    }
+    return NULL;
+}
+
+/*
+ * stream_op - read the next op from the trace file into op, with its 
+ *     trace id replaced by a slot number. Returns 0 at end of file.
+ */
+static int stream_op(tstream_t *s, traceop_t *op)
+{
+    char type[MAXLINE];
+    unsigned field[2];
+    int c, j, n, shift;
+
+    if (!s->binary) {
+	if (fscanf(s->fp, "%s", type) == EOF)
+	    return 0;
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    op->type = (type[0] == 'a') ? ALLOC : REALLOC;
+	    n = fscanf(s->fp, "%u %u", &field[0], &field[1]) - 2;
+	    break;
+	case 'f':
+	    op->type = FREE;
+	    n = fscanf(s->fp, "%u", &field[0]) - 1;
+	    field[1] = 0;
+	    break;
+	default:
+	    n = -1;
+	}
+    }
+    else if (!(s->flags & BT_PACKED)) {
+	if (fread(op, sizeof(*op), 1, s->fp) != 1)
+	    return 0;
+	field[0] = op->index;
+	field[1] = op->size;
+	n = (op->type <= REALLOC) ? 0 : -1;
+    }
+    else {
+	if ((c = getc(s->fp)) == EOF)
+	    return 0;
+	op->type = c;
+	n = (c <= REALLOC) ? 0 : -1;
+	field[1] = 0;
+	for (j = 0; (n == 0) && (j < ((op->type == FREE) ? 1 : 2)); j++) {
+	    field[j] = 0;
+	    for (shift = 0; ; shift += 7) {
+		if (((c = getc(s->fp)) == EOF) || (shift >= 32)) {
+		    n = -1;
+		    break;
+		}
+		field[j] |= (unsigned)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+		    break;
+	    }
+	}
+    }
+    if (n != 0) {
+	printf("Bad op in streamed tracefile %s\n", s->path);
+	exit(1);
+    }
+
+    op->index = stream_slot(s, field[0], op->type == FREE);
+    op->size = field[1];
+    return 1;
+}
+
+/*
+ * stream_slot - look up the slot of trace id in the id table, giving
+ *     it a fresh one if it isn't there yet. If remove is set, the id 
+ *     must be live; its entry is deleted and the slot recycled.
+ */
+static int stream_slot(tstream_t *s, unsigned id, int remove)
+{
+    unsigned i, j, k, mask, oldcap;
+    unsigned *oldids;
+    int *oldslot, slot;
+
+    /* Keep the table at most half full, rehashing when it doubles */
+    if (2*(s->live + 1) > s->cap) {
+	oldids = s->ids;
+	oldslot = s->idslot;
+	oldcap = s->cap;
+	s->cap = oldcap ? 2*oldcap : 1024;
+	if (((s->ids = malloc(s->cap * sizeof(unsigned))) == NULL) ||
+	    ((s->idslot = malloc(s->cap * sizeof(int))) == NULL) ||
+	    ((s->freeslots = realloc(s->freeslots, 
+				     s->cap * sizeof(int))) == NULL))
+	    unix_error("malloc failed in stream_slot");
+	for (i = 0; i < s->cap; i++)
+	    s->ids[i] = NO_ID;
+	mask = s->cap - 1;
+	for (j = 0; j < oldcap; j++) {
+	    if (oldids[j] == NO_ID)
+		continue;
+	    for (i = (oldids[j] * 2654435761u) & mask; s->ids[i] != NO_ID; 
+		 i = (i + 1) & mask)
+		;
+	    s->ids[i] = oldids[j];
+	    s->idslot[i] = oldslot[j];
+	}
+	free(oldids);
+	free(oldslot);
+    }
+
+    /* Linear probing */
+    mask = s->cap - 1;
+    for (i = (id * 2654435761u) & mask; (s->ids[i] != NO_ID) && (s->ids[i] != id);
+	 i = (i + 1) & mask)
+	;
+
+    if (s->ids[i] == NO_ID) {
+	if (remove) {
+	    printf("Free of unallocated id %u in tracefile %s\n", 
+		   id, s->path);
+	    exit(1);
+	}
+	/* Recycled slots are numbered below nslots, so the stack fits in cap */
+	s->ids[i] = id;
+	s->idslot[i] = (s->nslots - (int)s->live > 0) ? 
+	    s->freeslots[s->nslots - s->live - 1] : s->nslots++;
+	s->live++;
+	return s->idslot[i];
+    }
+
+    slot = s->idslot[i];
+    if (remove) {
+	/* Push the slot, then delete the entry by shifting its cluster back */
+	s->freeslots[s->nslots - s->live] = slot;
+	s->live--;
+	s->ids[i] = NO_ID;
+	for (j = (i + 1) & mask; s->ids[j] != NO_ID; j = (j + 1) & mask) {
+	    k = (s->ids[j] * 2654435761u) & mask;
+	    if (((j > i) && ((k <= i) || (k > j))) ||
+		((j < i) && ((k <= i) && (k > j)))) {
+		s->ids[i] = s->ids[j];
+		s->idslot[i] = s->idslot[j];
+		s->ids[j] = NO_ID;
+		i = j;
+	    }
+	}
+    }
+    return slot;
+}
+
 /**************
  * Main routine
  **************/
 int main(int argc, char **argv)
 {
-    int i;
+    int i, j;
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
@@ -150,6 +667,16 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int mt_threads = 0;  /* If set, replay on up to this many threads (-T) */
+    int mt_counts = 0;   /* number of thread counts in the -T scaling run */
+    int scaling = 0;     /* If set, run the scaling suite instead (-X) */
+    int stream = 0;      /* If set, stream traces instead of loading them (-S) */
+    int workers = 0;     /* If set, check traces in this many processes (-J) */
+    trace_t *(*load)(char *, char *) = read_trace; /* how to get at a trace */
+    mtstats_t *mm_mt = NULL;   /* mm stats for each trace and thread count */
+    mtstats_t *libc_mt = NULL; /* libc stats for each trace and thread count */
+    char *json = NULL;         /* If set, write the results here (-j) */
+    char *baseline = NULL;     /* If set, compare against these results (-b) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +685,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgaBCDHlLSF:J:K:M:P:T:Xn:w:c:j:b:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -181,9 +708,114 @@ int main(int argc, char **argv)
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
+        case 'B': /* Replay runs of like ops through the batch calls */
+            batched = 1;
+            break;
+        case 'C': /* Validate allocs made through mm_calloc */
+            zeroed = 1;
+            break;
+        case 'D': /* Defer coalescing small frees to quick bin sweeps */
+            if (mm_setopt(MM_DEFER_COALESCE, 1) != 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'H': /* Count hardware events per op (implies -v) */
+            hwcount = 1;
+            if (!verbose)
+		verbose = 1;
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'L': /* Time every op and report latency percentiles */
+            latency = 1;
+            if (!verbose)
+		verbose = 1;
+            break;
+        case 'F': /* Snapshot the heap every n ops into FRAGFILE */
+            if ((frag_every = atoi(optarg)) < 1) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'J': /* Check traces in up to n worker processes at once */
+            if ((workers = atoi(optarg)) < 1) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'K': /* mm_check a slice of n blocks after every op */
+            if (atoi(optarg) < 1) {
+		usage();
+		exit(1);
+	    }
+            check_every = atoi(optarg);
+            break;
+        case 'M': /* Back the heap with huge pages, prefaulted, on a node */
+            if (set_backing(optarg) != 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'P': /* Placement policy: first, next, best, best<K> or good */
+            if (!strcmp(optarg, "first"))
+		j = mm_setopt(MM_FIT_POLICY, MM_FIT_FIRST);
+            else if (!strcmp(optarg, "next"))
+		j = mm_setopt(MM_FIT_POLICY, MM_FIT_NEXT);
+            else if (!strcmp(optarg, "best"))
+		j = mm_setopt(MM_FIT_POLICY, MM_FIT_BEST);
+            else if (!strcmp(optarg, "good"))
+		j = mm_setopt(MM_FIT_POLICY, MM_FIT_GOOD);
+            else if (!strncmp(optarg, "best", 4))
+		j = mm_setopt(MM_FIT_POLICY, MM_FIT_BOUNDED) ||
+		    mm_setopt(MM_FIT_BOUND, atoi(optarg + 4));
+            else 
+		j = -1;
+            if (j != 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'S': /* Stream traces from disk rather than loading them */
+            stream = 1;
+            break;
+        case 'T': /* Replay each trace on 1, 2, 4, ... up to n threads */
+            if ((mt_threads = atoi(optarg)) < 1) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'X': /* Run the scaling suite rather than the default traces */
+            scaling = 1;
+            break;
+        case 'n': /* Time this many runs of each trace */
+            if ((j = atoi(optarg)) < 1) {
+		usage();
+		exit(1);
+	    }
+	    set_fsecs_samples(j);
+            break;
+        case 'w': /* ... after this many untimed warmup runs */
+            if ((j = atoi(optarg)) < 0) {
+		usage();
+		exit(1);
+	    }
+	    set_fsecs_warmup(j);
+            break;
+        case 'c': /* Pin the timed runs to this CPU */
+            if ((j = atoi(optarg)) < 0) {
+		usage();
+		exit(1);
+	    }
+	    set_fsecs_cpu(j);
+            break;
+        case 'j': /* Write the results as JSON */
+            json = optarg;
+            break;
+        case 'b': /* Compare the timings against an earlier -j file */
+            baseline = optarg;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -229,14 +861,25 @@ int main(int argc, char **argv)
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
      */
+    if ((tracefiles == NULL) && scaling) {
+	if (!strcmp(tracedir, TRACEDIR)) /* unless -t says otherwise */
+	    strcpy(tracedir, SCALEDIR);
+        tracefiles = scaling_tracefiles;
+        num_tracefiles = sizeof(scaling_tracefiles) / sizeof(char *) - 1;
+	printf("Using scaling tracefiles in %s\n", tracedir);
+    }
     if (tracefiles == NULL) {
         tracefiles = default_tracefiles;
         num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
-    /* Initialize the timing package */
+    /* Initialize the timing package, and the event counters with -H */
     init_fsecs();
+    if (hwcount && (perf_init() == 0))
+	fprintf(stderr, "mdriver: no hardware event counters on this box\n");
+    if (stream)
+	load = open_trace;
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -252,7 +895,7 @@ int main(int argc, char **argv)
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
+	    trace = load(tracedir, tracefiles[i]);
 	    libc_stats[i].ops = trace->num_ops;
 	    if (verbose > 1)
 		printf("Checking libc malloc for correctness, ");
@@ -261,7 +904,12 @@ int main(int argc, char **argv)
 		speed_params.trace = trace;
 		if (verbose > 1)
 		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		libc_stats[i].secs = fsecs_stats(eval_libc_speed, &speed_params,
+						 &libc_stats[i].timing);
+		if (hwcount)
+		    perf_count(eval_libc_speed, &speed_params, libc_stats[i].perf);
+		if (latency)
+		    eval_lat(trace, 1, &libc_stats[i]);
 	    }
 	    free_trace(trace);
 	}
@@ -270,6 +918,8 @@ int main(int argc, char **argv)
 	if (verbose) {
 	    printf("\nResults for libc malloc:\n");
 	    printresults(num_tracefiles, libc_stats);
+	    if (latency)
+		printlatresults(num_tracefiles, libc_stats);
 	}
     }
 
@@ -287,31 +937,110 @@ int main(int argc, char **argv)
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
+    if (frag_every && workers) {  /* the snapshots are of one heap at a time */
+	printf("ERROR: -F and -J can't be combined\n");
+	exit(1);
+    }
+    if (frag_every) {
+	if ((fragfile = fopen(FRAGFILE, "w")) == NULL)
+	    unix_error("Could not open " FRAGFILE);
+	fprintf(fragfile, "# trace op heap live internal free largest extfrag "
+		"nfree slabidle bins[%d]\n", MM_FRAG_BINS);
+    }
+
+    /* 
+     * Evaluate student's mm malloc package using the K-best scheme. With 
+     * -J, worker processes have already done the correctness and 
+     * utilization passes, so only the valid traces are timed, one by one.
+     */
+    if (workers)
+	eval_mm_workers(num_tracefiles, tracefiles, load, mm_stats, workers);
     for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
+	if (workers && !mm_stats[i].valid)
+	    continue;
+	trace = load(tracedir, tracefiles[i]);
 	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
+	if (!workers) {
+	    if (verbose > 1)
+		printf("Checking mm_malloc for correctness, ");
+	    mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	}
+	if (mm_stats[i].valid && !workers) {
 	    if (verbose > 1)
 		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    if (frag_every)
+		fprintf(fragfile, "# %s\n", tracefiles[i]);
+	    mm_stats[i].util = eval_mm_util(trace, i, &ranges, 
+					    &mm_stats[i].counters);
+	    if (frag_every)   /* blank lines separate traces for plotting */
+		fprintf(fragfile, "\n\n");
+	}
+	if (mm_stats[i].valid) {
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    mm_stats[i].secs = fsecs_stats(eval_mm_speed, &speed_params,
+					   &mm_stats[i].timing);
+	    if (hwcount)
+		perf_count(eval_mm_speed, &speed_params, mm_stats[i].perf);
+	    if (latency)
+		eval_lat(trace, 0, &mm_stats[i]);
 	}
 	free_trace(trace);
     }
 
+    if (frag_every)
+	fclose(fragfile);
+
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
+	if (latency)
+	    printlatresults(num_tracefiles, mm_stats);
+	if (counted)
+	    printcounters(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay every valid trace on 1, 2, 4, ... mt_threads
+     * threads at once, each thread with its own copy of the trace, for
+     * both mm and (as the baseline) libc malloc. The threads share one
+     * ops array, so these traces are always loaded, even with -S.
+     */
+    if (mt_threads > 0) {
+	for (j = 1; j < mt_threads; j *= 2)
+	    mt_counts++;
+	mt_counts++;
+
+	mm_mt = (mtstats_t *)calloc(num_tracefiles * mt_counts,
+				    sizeof(mtstats_t));
+	libc_mt = (mtstats_t *)calloc(num_tracefiles * mt_counts,
+				      sizeof(mtstats_t));
+	if ((mm_mt == NULL) || (libc_mt == NULL))
+	    unix_error("mt stats calloc in main failed");
+
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    for (j = 0; j < mt_counts; j++) {
+		int threads = (j == mt_counts-1) ? mt_threads : (1 << j);
+		if (verbose > 1)
+		    printf("Replaying on %d threads.\n", threads);
+		eval_mt(trace, threads, 0, &mm_mt[i*mt_counts + j]);
+		eval_mt(trace, threads, 1, &libc_mt[i*mt_counts + j]);
+	    }
+	    free_trace(trace);
+	}
+
+	printf("\nMulti-threaded results (each thread replays the whole trace):\n");
+	printmtresults(num_tracefiles, mt_counts, mm_mt, libc_mt);
 	printf("\n");
+	free(mm_mt);
+	free(libc_mt);
     }
 
     /* 
@@ -362,21 +1091,31 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    /* Save the results, and fail if any trace got slower than before */
+    if (json)
+	write_json(json, num_tracefiles, tracefiles, mm_stats, perfindex);
+    if (baseline && 
+	(compare_baseline(baseline, num_tracefiles, tracefiles, mm_stats) > 0))
+	exit(2);
+
     exit(0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range index, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range index to detect any overlapping allocated blocks. It is a
+ * treap (a binary search tree on lo that is also a heap on random
+ * priorities), so insert, remove and the overlap query are all
+ * O(log n) expected time.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range index. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
@@ -395,36 +1134,38 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or a mapped region */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_in_region(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. Since the ranges
+     * are disjoint, only the one with the highest lo not above hi can.
+     */
+    if (((p = find_range(*ranges, hi)) != NULL) && (p->hi >= lo)) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range index.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->prio = rand();
+    p->left = p->right = NULL;
+    insert_range(ranges, p);
     return 1;
 }
 
@@ -433,19 +1174,28 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
+    range_t **pp = ranges;
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((*pp != NULL) && ((*pp)->lo != lo))
+	pp = (lo < (*pp)->lo) ? &(*pp)->left : &(*pp)->right;
+    if (*pp == NULL)
+	return;
+
+    /* Rotate the node down until it has at most one child, then unlink it */
+    while (((*pp)->left != NULL) && ((*pp)->right != NULL)) {
+	if ((*pp)->left->prio > (*pp)->right->prio) {
+	    rotate_right(pp);
+	    pp = &(*pp)->right;
+	}
+	else {
+	    rotate_left(pp);
+	    pp = &(*pp)->left;
+	}
     }
+    p = *pp;
+    *pp = (p->left != NULL) ? p->left : p->right;
+    free(p);
 }
 
 /*
@@ -453,14 +1203,84 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    free_ranges(*ranges);
+    *ranges = NULL;
+}
+
+/*
+ * find_range - return the range with the highest lo that is <= hi,
+ *     or NULL if there is none
+ */
+static range_t *find_range(range_t *ranges, char *hi)
+{
+    range_t *best = NULL;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    while (ranges != NULL) {
+	if (ranges->lo <= hi) {
+	    best = ranges;
+	    ranges = ranges->right;
+	}
+	else
+	    ranges = ranges->left;
     }
-    *ranges = NULL;
+    return best;
+}
+
+/*
+ * insert_range - insert range p into the treap rooted at *ranges,
+ *     rotating it up while its priority beats its parent's
+ */
+static void insert_range(range_t **ranges, range_t *p)
+{
+    if (*ranges == NULL) {
+	*ranges = p;
+    }
+    else if (p->lo < (*ranges)->lo) {
+	insert_range(&(*ranges)->left, p);
+	if ((*ranges)->left->prio > (*ranges)->prio)
+	    rotate_right(ranges);
+    }
+    else {
+	insert_range(&(*ranges)->right, p);
+	if ((*ranges)->right->prio > (*ranges)->prio)
+	    rotate_left(ranges);
+    }
+}
+
+/*
+ * rotate_left - make the right child of *ranges the root of its subtree
+ */
+static void rotate_left(range_t **ranges)
+{
+    range_t *r = (*ranges)->right;
+
+    (*ranges)->right = r->left;
+    r->left = *ranges;
+    *ranges = r;
+}
+
+/*
+ * rotate_right - make the left child of *ranges the root of its subtree
+ */
+static void rotate_right(range_t **ranges)
+{
+    range_t *l = (*ranges)->left;
+
+    (*ranges)->left = l->right;
+    l->right = *ranges;
+    *ranges = l;
+}
+
+/*
+ * free_ranges - free every range record in a subtree
+ */
+static void free_ranges(range_t *ranges)
+{
+    if (ranges == NULL)
+	return;
+    free_ranges(ranges->left);
+    free_ranges(ranges->right);
+    free(ranges);
 }
 
 
@@ -469,7 +1289,9 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. Text (.rep)
+ *     traces are parsed; binary traces (see trace.h) are handed off
+ *     to read_bintrace.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
@@ -480,6 +1302,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     unsigned index, size;
     unsigned max_index = 0;
     unsigned op_index;
+    unsigned magic;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -487,6 +1310,9 @@ static trace_t *read_trace(char *tracedir, char *filename)
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
+    trace->map = NULL;
+    trace->maplen = 0;
+    trace->stream = NULL;
 	
     /* Read the trace file header */
     strcpy(path, tracedir);
@@ -495,6 +1321,16 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
+
+    /* Binary traces start with a magic number that no text trace can */
+    if ((fread(&magic, sizeof(magic), 1, tracefile) == 1) && 
+	(magic == BT_MAGIC)) {
+	read_bintrace(trace, fileno(tracefile), path);
+	fclose(tracefile);
+	return trace;
+    }
+    rewind(tracefile);
+
     fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
@@ -555,27 +1391,154 @@ static trace_t *read_trace(char *tracedir, char *filename)
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * read_bintrace - map a binary trace file. Unpacked op streams are
+ *     used in place as the ops array; packed ones are decoded into a
+ *     malloc'd array and the mapping is dropped.
  */
-void free_trace(trace_t *trace)
+static void read_bintrace(trace_t *trace, int fd, char *path)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
-}
+    struct stat st;
+    bintrace_hdr_t *hdr;
+    unsigned char *base;
+    traceop_t *op;
+    int i;
 
-/**********************************************************************
- * The following functions evaluate the correctness, space utilization,
- * and throughput of the libc and mm malloc packages.
- **********************************************************************/
+    if (fstat(fd, &st) < 0)
+	unix_error("fstat failed in read_bintrace");
+    if (st.st_size < sizeof(bintrace_hdr_t)) {
+	sprintf(msg, "Truncated binary tracefile %s", path);
+	app_error(msg);
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+	unix_error("mmap failed in read_bintrace");
+
+    hdr = (bintrace_hdr_t *)base;
+    if (hdr->version != BT_VERSION) {
+	sprintf(msg, "Unsupported binary trace version %u in %s", 
+		hdr->version, path);
+	app_error(msg);
+    }
+    if ((hdr->num_ids < 0) || (hdr->num_ops < 0) ||
+	(hdr->oplen > st.st_size - sizeof(bintrace_hdr_t)) ||
+	(!(hdr->flags & BT_PACKED) && 
+	 (hdr->oplen != (size_t)hdr->num_ops * sizeof(traceop_t)))) {
+	sprintf(msg, "Corrupt binary trace header in %s", path);
+	app_error(msg);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_bintrace");
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_bintrace");
+
+    if (hdr->flags & BT_PACKED) {
+	unpack_ops(trace, base + sizeof(bintrace_hdr_t), 
+		   base + sizeof(bintrace_hdr_t) + hdr->oplen, path);
+	munmap(base, st.st_size);
+    }
+    else {
+	/* Tell the kernel we'll run straight through the ops */
+	madvise(base, st.st_size, MADV_SEQUENTIAL); 
+	trace->ops = (traceop_t *)(base + sizeof(bintrace_hdr_t));
+	trace->map = base;
+	trace->maplen = st.st_size;
+
+	/* The ops are replayed as is, so check each against the header */
+	for (i = 0; i < trace->num_ops; i++) {
+	    op = &trace->ops[i];
+	    if (((unsigned)op->type > REALLOC) || (op->index < 0) ||
+		(op->index >= trace->num_ids) || (op->size < 0)) {
+		sprintf(msg, "Corrupt op %d in binary tracefile %s", i, path);
+		app_error(msg);
+	    }
+	}
+    }
+}
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * unpack_ops - decode a varint packed op stream [p, end) into a
+ *     freshly allocated ops array, checking every op against the header
+ */
+static void unpack_ops(trace_t *trace, unsigned char *p, 
+		       unsigned char *end, char *path)
+{
+    unsigned field[2];
+    int i, j, n, shift;
+
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in unpack_ops");
+
+    for (i = 0; i < trace->num_ops; i++) {
+	if ((p >= end) || (*p > REALLOC))
+	    break;
+	trace->ops[i].type = *p++;
+	n = (trace->ops[i].type == FREE) ? 1 : 2;
+	for (j = 0; j < n; j++) {
+	    field[j] = 0;
+	    for (shift = 0; (p < end) && (shift < 32); shift += 7) {
+		field[j] |= (unsigned)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80))
+		    break;
+	    }
+	}
+	if ((p > end) || (field[0] >= trace->num_ids))
+	    break;
+	trace->ops[i].index = field[0];
+	trace->ops[i].size = (n == 2) ? field[1] : 0;
+    }
+    if (i < trace->num_ops) {
+	sprintf(msg, "Corrupt packed op %d in binary tracefile %s", i, path);
+	app_error(msg);
+    }
+}
+
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated in read_trace(). A
+ *              mapped ops array is unmapped instead.
+ */
+void free_trace(trace_t *trace)
+{
+    if (trace->stream != NULL) {
+	stream_stop(trace->stream);
+	fclose(trace->stream->fp);
+	free(trace->stream->buf[0]);
+	free(trace->stream->buf[1]);
+	free(trace->stream->ids);
+	free(trace->stream->idslot);
+	free(trace->stream->freeslots);
+	pthread_mutex_destroy(&trace->stream->lock);
+	pthread_cond_destroy(&trace->stream->cond);
+	free(trace->stream);
+    }
+    else if (trace->map != NULL)   /* free the three arrays... */
+	munmap(trace->map, trace->maplen);
+    else
+	free(trace->ops);         
+    free(trace->blocks);      
+    free(trace->block_sizes);
+    free(trace);              /* and the trace record itself... */
+}
+
+/**********************************************************************
+ * The following functions evaluate the correctness, space utilization,
+ * and throughput of the libc and mm malloc packages.
+ **********************************************************************/
+
+/*
+ * eval_mm_valid - Check the mm malloc package for correctness
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
 {
+    traceop_t *op;
     int i, j;
     int index;
     int size;
@@ -583,8 +1546,9 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *newp;
     char *oldp;
     char *p;
+    batch_t b;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range index */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -595,23 +1559,45 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-	index = trace->ops[i].index;
-	size = trace->ops[i].size;
+    b.n = 0;
+    trace_rewind(trace);
+    for (i = 0;  (op = next_op(trace)) != NULL;  i++) {
+	index = op->index;
+	size = op->size;
+
+	/* With -B, gather the op into the current run of like ops */
+	if (batched && !batch_add(&b, op)) {
+	    if (!batch_valid(trace, tracenum, i, &b, ranges))
+		return 0;
+	    if (batch_add(&b, op))
+		continue;
+	}
+	else if (batched)
+	    continue;
 
-        switch (trace->ops[i].type) {
+        switch (op->type) {
 
         case ALLOC: /* mm_malloc */
 
-	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    /* Call the student's malloc (or calloc, with -C) */
+	    p = zeroed ? mm_calloc(1, size) : mm_malloc(size);
+	    if (p == NULL) {
+		malloc_error(tracenum, i, zeroed ? "mm_calloc failed." :
+			     "mm_malloc failed.");
 		return 0;
 	    }
 	    
+	    /* A calloc'ed block must come back zeroed */
+	    for (j = 0; zeroed && (j < size); j++) {
+		if (p[j] != 0) {
+		    malloc_error(tracenum, i, "mm_calloc did not zero the block");
+		    return 0;
+		}
+	    }
+
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range index if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
@@ -638,10 +1624,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range index */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range index */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
@@ -653,7 +1639,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -668,7 +1654,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case FREE: /* mm_free */
 	    
-	    /* Remove region from list and call student's free function */
+	    /* Remove region from index and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
 	    mm_free(p);
@@ -678,25 +1664,125 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* With -K, check the next slice of the heap */
+	if (check_every && (mm_check(check_every) < 0)) {
+	    malloc_error(tracenum, i, "mm_check failed.");
+	    return 0;
+	}
+    }
+    if (batched && !batch_valid(trace, tracenum, i, &b, ranges))
+	return 0;
+
+    /* ... and all of it once the trace is done */
+    if (check_every && (mm_check(0) < 0)) {
+	malloc_error(tracenum, i, "mm_check failed.");
+	return 0;
     }
 
     /* As far as we know, this is a valid malloc package */
     return 1;
 }
 
+/*
+ * batch_add - add op to the run of like ops in b if it can join it,
+ *     returning 0 if the run must be replayed first. Reallocs never 
+ *     join a run, and nor do allocs when they are checked through 
+ *     mm_calloc (-C), which has no batch call.
+ */
+static int batch_add(batch_t *b, traceop_t *op)
+{
+    if ((op->type == REALLOC) || ((op->type == ALLOC) && zeroed))
+	return 0;
+    if (b->n > 0) {
+	if ((b->n == BATCH_MAX) || (op->type != b->type) ||
+	    ((op->type == ALLOC) && (op->size != b->size)))
+	    return 0;
+    }
+    else {
+	b->type = op->type;
+	b->size = op->size;
+    }
+    b->index[b->n++] = op->index;
+    return 1;
+}
+
+/*
+ * batch_run - replay the run of ops in b with one batch call, recording
+ *     the blocks of allocs in the trace. Returns the number of ops that
+ *     succeeded, which is b->n unless mm_malloc_batch ran out of memory.
+ */
+static int batch_run(trace_t *trace, batch_t *b)
+{
+    int i, n = b->n;
+
+    if (n == 0)
+	return 0;
+    if (b->type == FREE) {
+	for (i = 0; i < n; i++)
+	    b->ptrs[i] = trace->blocks[b->index[i]];
+	mm_free_batch(b->ptrs, n);
+	return n;
+    }
+
+    n = mm_malloc_batch(b->size, n, b->ptrs);
+    for (i = 0; i < n; i++) {
+	trace->blocks[b->index[i]] = b->ptrs[i];
+	trace->block_sizes[b->index[i]] = b->size;
+    }
+    return n;
+}
+
+/*
+ * batch_valid - replay the run of ops in b for eval_mm_valid, checking 
+ *     each block as a single op would be checked, and empty the run.
+ *     opnum is the number of the op following the run.
+ */
+static int batch_valid(trace_t *trace, int tracenum, int opnum, batch_t *b,
+		       range_t **ranges)
+{
+    int i, n = b->n;
+    char *p;
+
+    if (n == 0)
+	return 1;
+
+    if (b->type == FREE) {
+	for (i = 0; i < n; i++)
+	    remove_range(ranges, trace->blocks[b->index[i]]);
+	batch_run(trace, b);
+	b->n = 0;
+	return 1;
+    }
+
+    if (batch_run(trace, b) < n) {
+	malloc_error(tracenum, opnum - n, "mm_malloc_batch failed.");
+	return 0;
+    }
+    for (i = 0; i < n; i++) {
+	p = b->ptrs[i];
+	if (add_range(ranges, p, b->size, tracenum, opnum - n + i) == 0)
+	    return 0;
+	memset(p, b->index[i] & 0xFF, b->size);
+    }
+    b->n = 0;
+    return 1;
+}
+
 /* 
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   largest size of the heap (plus any mapped regions) in bytes while
+ *   running the student's malloc package on the trace. Note that
+ *   mem_sbrk() allows the students to decrement the brk pointer, so we
+ *   use the high water mark of brk rather than its final value.
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   mm_stats_t *counters)
 {   
+    traceop_t *op;
     int i;
     int index;
     int size, newsize, oldsize;
@@ -704,18 +1790,36 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     int total_size = 0;
     char *p;
     char *newp, *oldp;
+    batch_t b;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    b.n = 0;
+    trace_rewind(trace);
+    for (i = 0;  (op = next_op(trace)) != NULL;  i++) {
+	/* With -B, a heap snapshot waits for the pending run of ops */
+	if (batched && frag_every && (i % frag_every == 0))
+	    util_batch(trace, &b, &total_size, &max_total_size);
+	if (frag_every && (i % frag_every == 0))
+	    frag_sample(tracenum, i, total_size);
+
+	/* With -B, gather the op into the current run of like ops */
+	if (batched) {
+	    if (batch_add(&b, op))
+		continue;
+	    util_batch(trace, &b, &total_size, &max_total_size);
+	    if (batch_add(&b, op))
+		continue;
+	}
+
+        switch (op->type) {
 
         case ALLOC: /* mm_alloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
+	    index = op->index;
+	    size = op->size;
 
 	    if ((p = mm_malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
@@ -734,8 +1838,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
 	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
+	    index = op->index;
+	    newsize = op->size;
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
@@ -756,7 +1860,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
         case FREE: /* mm_free */
-	    index = trace->ops[i].index;
+	    index = op->index;
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
@@ -773,10 +1877,126 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
         }
     }
+    if (batched)
+	util_batch(trace, &b, &total_size, &max_total_size);
+
+    if (frag_every)
+	frag_sample(tracenum, i, total_size);
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    /* This pass is a plain replay, so its counts describe the trace */
+    counted = (mm_stats(counters) == 0);
+
+    return ((double)max_total_size / (double)mem_peaksize());
 }
 
+/*
+ * util_batch - replay the run of ops in b for eval_mm_util, keeping its
+ *     running and peak totals of allocated bytes, and empty the run
+ */
+static void util_batch(trace_t *trace, batch_t *b, int *total_size, 
+		       int *max_total_size)
+{
+    int i;
+
+    if (b->n == 0)
+	return;
+    if (b->type == FREE) {
+	for (i = 0; i < b->n; i++)
+	    *total_size -= trace->block_sizes[b->index[i]];
+	batch_run(trace, b);
+    }
+    else {
+	if (batch_run(trace, b) < b->n)
+	    app_error("mm_malloc_batch failed in eval_mm_util");
+	*total_size += b->n * b->size;
+	if (*total_size > *max_total_size)
+	    *max_total_size = *total_size;
+    }
+    b->n = 0;
+}
+
+
+/*
+ * eval_mm_workers - run the correctness and utilization passes of the
+ *     mm package over the n traces in up to workers child processes at 
+ *     once, one trace each, and gather their results into stats. Each
+ *     child works on its own copy of the memlib heap, and reports back
+ *     through a pipe; a trace whose child dies without reporting, say
+ *     on a segfault in mm.c, is invalid.
+ */
+static void eval_mm_workers(int n, char **tracefiles, 
+			    trace_t *(*load)(char *, char *), stats_t *stats, 
+			    int workers)
+{
+    pid_t *pids, pid;
+    int *fds, fd[2];
+    int next = 0, running = 0, i, status;
+    range_t *ranges = NULL;
+    trace_t *trace;
+    result_t res;
+
+    if (((pids = calloc(n, sizeof(pid_t))) == NULL) || 
+	((fds = calloc(n, sizeof(int))) == NULL))
+	unix_error("calloc failed in eval_mm_workers");
+
+    while ((next < n) || (running > 0)) {
+	/* Start a worker on the next trace if there's room for it */
+	if ((next < n) && (running < workers)) {
+	    if (pipe(fd) < 0)
+		unix_error("pipe failed in eval_mm_workers");
+	    fflush(stdout);  /* or the child would print it again */
+	    if ((pid = fork()) < 0)
+		unix_error("fork failed in eval_mm_workers");
+	    if (pid == 0) {
+		close(fd[0]);
+		if (verbose > 1)
+		    printf("Checking %s in process %d.\n", tracefiles[next], 
+			   (int)getpid());
+		memset(&res, 0, sizeof(res));
+		trace = load(tracedir, tracefiles[next]);
+		res.ops = trace->num_ops;
+		res.valid = eval_mm_valid(trace, next, &ranges);
+		if (res.valid)
+		    res.util = eval_mm_util(trace, next, &ranges, &res.counters);
+		res.counted = counted;
+		res.errors = errors;
+		if (write(fd[1], &res, sizeof(res)) != sizeof(res))
+		    unix_error("write failed in eval_mm_workers");
+		exit(0);
+	    }
+	    close(fd[1]);
+	    pids[next] = pid;
+	    fds[next] = fd[0];
+	    next++;
+	    running++;
+	    continue;
+	}
+
+	/* Otherwise wait for one to finish, and collect its results */
+	if ((pid = wait(&status)) < 0)
+	    unix_error("wait failed in eval_mm_workers");
+	for (i = 0; (i < n) && (pids[i] != pid); i++)
+	    ;
+	if (i == n)
+	    continue;
+	running--;
+	if (read(fds[i], &res, sizeof(res)) != sizeof(res)) {
+	    printf("ERROR [trace %d]: worker process failed (status %d)\n", 
+		   i, status);
+	    memset(&res, 0, sizeof(res));
+	    res.errors = 1;
+	}
+	close(fds[i]);
+	stats[i].ops = res.ops;
+	stats[i].valid = res.valid;
+	stats[i].util = res.util;
+	stats[i].counters = res.counters;
+	counted |= res.counted;
+	errors += res.errors;
+    }
+    free(pids);
+    free(fds);
+}
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
@@ -784,9 +2004,11 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
+    traceop_t *op;
     int i, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    batch_t b;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
@@ -794,20 +2016,33 @@ static void eval_mm_speed(void *ptr)
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    b.n = 0;
+    trace_rewind(trace);
+    for (i = 0;  (op = next_op(trace)) != NULL;  i++) {
+	/* With -B, gather the op into the current run of like ops */
+	if (batched) {
+	    if (batch_add(&b, op))
+		continue;
+	    if (batch_run(trace, &b) < b.n)
+		app_error("mm_malloc_batch error in eval_mm_speed");
+	    b.n = 0;
+	    if (batch_add(&b, op))
+		continue;
+	}
+
+        switch (op->type) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = op->index;
+            size = op->size;
             if ((p = mm_malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
 
 	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+	    index = op->index;
+            newsize = op->size;
 	    oldp = trace->blocks[index];
             if ((newp = mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
@@ -815,7 +2050,7 @@ static void eval_mm_speed(void *ptr)
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = op->index;
             block = trace->blocks[index];
             mm_free(block);
             break;
@@ -823,6 +2058,9 @@ static void eval_mm_speed(void *ptr)
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+    }
+    if (batched && (batch_run(trace, &b) < b.n))
+	app_error("mm_malloc_batch error in eval_mm_speed");
 }
 
 /*
@@ -833,32 +2071,34 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
+    traceop_t *op;
     int i, newsize;
     char *p, *newp, *oldp;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    trace_rewind(trace);
+    for (i = 0;  (op = next_op(trace)) != NULL;  i++) {
+        switch (op->type) {
 
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+	    if ((p = malloc(op->size)) == NULL) {
 		malloc_error(tracenum, i, "libc malloc failed");
 		unix_error("System message");
 	    }
-	    trace->blocks[trace->ops[i].index] = p;
+	    trace->blocks[op->index] = p;
 	    break;
 
 	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
+            newsize = op->size;
+	    oldp = trace->blocks[op->index];
 	    if ((newp = realloc(oldp, newsize)) == NULL) {
 		malloc_error(tracenum, i, "libc realloc failed");
 		unix_error("System message");
 	    }
-	    trace->blocks[trace->ops[i].index] = newp;
+	    trace->blocks[op->index] = newp;
 	    break;
 	    
         case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+	    free(trace->blocks[op->index]);
 	    break;
 
 	default:
@@ -876,24 +2116,26 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
+    traceop_t *op;
     int i;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    trace_rewind(trace);
+    for (i = 0;  (op = next_op(trace)) != NULL;  i++) {
+        switch (op->type) {
         case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
+	    index = op->index;
+	    size = op->size;
 	    if ((p = malloc(size)) == NULL)
 		unix_error("malloc failed in eval_libc_speed");
 	    trace->blocks[index] = p;
 	    break;
 
 	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
+	    index = op->index;
+	    newsize = op->size;
 	    oldp = trace->blocks[index];
 	    if ((newp = realloc(oldp, newsize)) == NULL)
 		unix_error("realloc failed in eval_libc_speed\n");
@@ -902,7 +2144,7 @@ static void eval_libc_speed(void *ptr)
 	    break;
 	    
         case FREE: /* free */
-	    index = trace->ops[i].index;
+	    index = op->index;
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
@@ -910,6 +2152,284 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/*
+ * eval_mt - Replay the trace on the given number of threads at once,
+ *    each with its own block array, using mm (or libc if libc is set).
+ *    The mm heap is reset first. Threads start together at a barrier,
+ *    and the wall time runs from the first start to the last finish.
+ */
+static void eval_mt(trace_t *trace, int threads, int libc, mtstats_t *stats)
+{
+    int i;
+    pthread_t *tids;
+    mtarg_t *args;
+    pthread_barrier_t start;
+    double first, last;
+
+    if (!libc) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mt");
+    }
+
+    tids = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    args = (mtarg_t *)malloc(threads * sizeof(mtarg_t));
+    if ((tids == NULL) || (args == NULL))
+	unix_error("malloc failed in eval_mt");
+    pthread_barrier_init(&start, NULL, threads + 1);
+
+    for (i = 0; i < threads; i++) {
+	args[i].trace = trace;
+	args[i].libc = libc;
+	args[i].start = &start;
+	if ((args[i].blocks = 
+	     (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	    unix_error("malloc failed in eval_mt");
+	if (pthread_create(&tids[i], NULL, eval_mt_thread, &args[i]) != 0)
+	    unix_error("pthread_create failed in eval_mt");
+    }
+
+    pthread_barrier_wait(&start);
+    for (i = 0; i < threads; i++)
+	pthread_join(tids[i], NULL);
+
+    first = args[0].start_secs;
+    last = args[0].end_secs;
+    stats->tsecs = 0;
+    for (i = 0; i < threads; i++) {
+	if (args[i].start_secs < first)
+	    first = args[i].start_secs;
+	if (args[i].end_secs > last)
+	    last = args[i].end_secs;
+	stats->tsecs += args[i].end_secs - args[i].start_secs;
+	free(args[i].blocks);
+    }
+    stats->threads = threads;
+    stats->ops = (double)threads * trace->num_ops;
+    stats->secs = last - first;
+
+    pthread_barrier_destroy(&start);
+    free(args);
+    free(tids);
+}
+
+/*
+ * eval_mt_thread - Body of one eval_mt thread: replays the whole trace 
+ *    once and records how long that took.
+ */
+static void *eval_mt_thread(void *ptr)
+{
+    mtarg_t *arg = (mtarg_t *)ptr;
+    trace_t *trace = arg->trace;
+    char **blocks = arg->blocks;
+    int i, index, size;
+    char *p;
+
+    pthread_barrier_wait(arg->start);
+    arg->start_secs = mt_now();
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	    p = arg->libc ? malloc(size) : mm_malloc(size);
+	    if (p == NULL)
+		app_error("malloc failed in eval_mt_thread");
+	    blocks[index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+	    p = arg->libc ? realloc(blocks[index], size) 
+		: mm_realloc(blocks[index], size);
+	    if (p == NULL)
+		app_error("realloc failed in eval_mt_thread");
+	    blocks[index] = p;
+	    break;
+
+        case FREE: /* free */
+	    if (arg->libc) 
+		free(blocks[index]);
+	    else 
+		mm_free(blocks[index]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mt_thread");
+	}
+    }
+
+    arg->end_secs = mt_now();
+    return NULL;
+}
+
+/*
+ * eval_lat - Replay the trace once more, timing every op on its own 
+ *    with the cycle counter, and gather the times into one histogram
+ *    per op type (plus one of all ops) in stats->lat. The overhead of
+ *    reading the counter is subtracted from every sample.
+ */
+static void eval_lat(trace_t *trace, int libc, stats_t *stats)
+{
+    traceop_t *op;
+    int i, index, size, type;
+    char *p = NULL;
+    double cyc, overhead;
+    hist_t *h;
+
+    if ((stats->lat == NULL) && 
+	((stats->lat = (hist_t *)malloc(LAT_TYPES * sizeof(hist_t))) == NULL))
+	unix_error("malloc failed in eval_lat");
+    memset(stats->lat, 0, LAT_TYPES * sizeof(hist_t));
+
+    /* The counter's own cost is the fastest of a few back-to-back reads */
+    overhead = ovhd();
+    for (i = 0; i < 10; i++) {
+	cyc = ovhd();
+	overhead = (cyc < overhead) ? cyc : overhead;
+    }
+
+    if (!libc) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_lat");
+    }
+
+    trace_rewind(trace);
+    for (i = 0;  (op = next_op(trace)) != NULL;  i++) {
+	index = op->index;
+	size = op->size;
+	type = op->type;
+        switch (type) {
+
+        case ALLOC: /* malloc */
+	    start_counter();
+	    p = libc ? malloc(size) : mm_malloc(size);
+	    cyc = get_counter();
+	    if (p == NULL)
+		app_error("malloc failed in eval_lat");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+	    start_counter();
+	    p = libc ? realloc(trace->blocks[index], size) 
+		: mm_realloc(trace->blocks[index], size);
+	    cyc = get_counter();
+	    if (p == NULL)
+		app_error("realloc failed in eval_lat");
+	    trace->blocks[index] = p;
+	    break;
+
+        case FREE: /* free */
+	    p = trace->blocks[index];
+	    start_counter();
+	    if (libc) 
+		free(p);
+	    else 
+		mm_free(p);
+	    cyc = get_counter();
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_lat");
+	}
+
+	cyc = (cyc > overhead) ? cyc - overhead : 0;
+	for (h = &stats->lat[type]; ; h = &stats->lat[LAT_ALL]) {
+	    h->count[lat_bucket(cyc)]++;
+	    h->n++;
+	    if (cyc > h->max)
+		h->max = cyc;
+	    if (h == &stats->lat[LAT_ALL])
+		break;
+	}
+    }
+}
+
+/*
+ * lat_bucket - Map a latency to its histogram bucket. Latencies below
+ *    LAT_SUB have a bucket each; above that, each power of two is split
+ *    into LAT_SUB equal buckets, so the error is under 1/LAT_SUB.
+ */
+static int lat_bucket(double cycles)
+{
+    unsigned long long v = (unsigned long long)cycles;
+    int e;
+
+    if (v < LAT_SUB)
+	return (int)v;
+    for (e = LAT_SUB_BITS; (v >> e) > 1; e++)
+	;
+    return LAT_SUB * (e - LAT_SUB_BITS + 1) + 
+	(int)((v >> (e - LAT_SUB_BITS)) - LAT_SUB);
+}
+
+/*
+ * lat_percentile - Return the q-th quantile of the histogram, as the
+ *    upper end of the bucket it falls in (but no more than the max)
+ */
+static double lat_percentile(hist_t *h, double q)
+{
+    double target = q * h->n, seen = 0, hi;
+    int b, e;
+
+    if (h->n == 0)
+	return 0;
+    for (b = 0; b < LAT_BUCKETS - 1; b++) {
+	seen += h->count[b];
+	if (seen >= target)
+	    break;
+    }
+    if (b < LAT_SUB)
+	hi = b;
+    else {
+	e = b / LAT_SUB - 1 + LAT_SUB_BITS;
+	hi = (double)(LAT_SUB + b % LAT_SUB + 1) * 
+	    (double)(1ULL << (e - LAT_SUB_BITS)) - 1;
+    }
+    return (hi < h->max) ? hi : h->max;
+}
+
+/*
+ * frag_sample - Append a snapshot of the mm heap, taken before op opnum 
+ *    of trace tracenum while payload bytes are allocated, to FRAGFILE. 
+ *    Internal fragmentation is everything allocated beyond the payload
+ *    (headers, DWORD rounding, slot rounding); external fragmentation 
+ *    is the share of free memory outside the largest free block.
+ */
+static void frag_sample(int tracenum, int opnum, int payload)
+{
+    mm_heapinfo_t h;
+    unsigned long alloc;
+    int j;
+
+    if (mm_heapinfo(&h) < 0)
+	return;
+    alloc = h.alloc_bytes + h.mapped_bytes;
+    fprintf(fragfile, "%d %d %lu %d %ld %lu %lu %.4f %lu %lu", 
+	    tracenum, opnum, h.heap_bytes + h.mapped_bytes, payload,
+	    (long)alloc - payload, h.free_bytes, h.largest_free,
+	    h.free_bytes ? 1.0 - (double)h.largest_free / h.free_bytes : 0.0, 
+	    h.free_blocks, h.slab_idle);
+    for (j = 0; j < MM_FRAG_BINS; j++)
+	fprintf(fragfile, " %lu", h.free_hist[j]);
+    fprintf(fragfile, "\n");
+}
+
+/*
+ * mt_now - Return a monotonic timestamp in seconds, comparable between
+ *    threads
+ */
+static double mt_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1E-9*ts.tv_nsec;
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -924,54 +2444,358 @@ static void printresults(int n, stats_t *stats)
     double secs = 0;
     double ops = 0;
     double util = 0;
+    hist_t all;
+    double perf[PERF_EVENTS];
+    int j;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%9s%10s%6s%6s", 
+	   "trace", " valid", "util", "ops", "secs", "Kops", "mad");
+    if (latency)
+	printf("%8s%8s%8s%8s", "p50", "p90", "p99", "max");
+    if (hwcount)  /* per op */
+	for (j = 0; j < PERF_EVENTS; j++)
+	    printf("%7s", perf_names[j]);
+    printf("\n");
+    memset(&all, 0, sizeof(all));
+    memset(perf, 0, sizeof(perf));
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%9.0f%10.6f%6.0f%5.1f%%", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
-		   (stats[i].ops/1e3)/stats[i].secs);
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   100.0*stats[i].timing.mad/stats[i].secs);
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+	    if (latency) {
+		printlat(&stats[i].lat[LAT_ALL]);
+		for (j = 0; j < LAT_BUCKETS; j++)
+		    all.count[j] += stats[i].lat[LAT_ALL].count[j];
+		all.n += stats[i].lat[LAT_ALL].n;
+		if (stats[i].lat[LAT_ALL].max > all.max)
+		    all.max = stats[i].lat[LAT_ALL].max;
+	    }
+	    if (hwcount) {
+		printperf(stats[i].perf, stats[i].ops);
+		for (j = 0; j < PERF_EVENTS; j++)
+		    if ((perf[j] < 0) || (stats[i].perf[j] < 0))
+			perf[j] = -1;
+		    else
+			perf[j] += stats[i].perf[j];
+	    }
+	    printf("\n");
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n", 
+	    printf("%2d%10s%6s%9s%10s%6s%6s\n", 
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
+		   "-",
 		   "-");
 	}
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%9.0f%10.6f%6.0f%6s", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       ops, 
 	       secs,
-	       (ops/1e3)/secs);
+	       (ops/1e3)/secs,
+	       "");
+	if (latency)
+	    printlat(&all);
+	if (hwcount)
+	    printperf(perf, ops);
+	printf("\n");
     }
     else {
-	printf("%12s%6s%8s%10s%6s\n", 
+	printf("%12s%6s%9s%10s%6s%6s\n", 
 	       "Total       ",
 	       "-", 
 	       "-", 
 	       "-", 
+	       "-",
 	       "-");
     }
 
 }
 
+/*
+ * printperf - print the hardware event counts of a run per op, as
+ *     columns of a printresults table
+ */
+static void printperf(double *counts, double ops)
+{
+    int i;
+
+    for (i = 0; i < PERF_EVENTS; i++)
+	if (counts[i] < 0)
+	    printf("%7s", "-");
+	else
+	    printf("%7.*f", (counts[i] < 10*ops) ? 2 : 0, counts[i]/ops);
+}
+
+/*
+ * write_json - save the results of the mm package on each trace, and
+ *     how they were timed, as JSON. Each trace gets a line of its own,
+ *     which is what compare_baseline expects of its baseline.
+ */
+static void write_json(char *path, int n, char **tracefiles, stats_t *stats,
+		       double perfindex)
+{
+    FILE *fp;
+    int i;
+
+    if ((fp = fopen(path, "w")) == NULL)
+	unix_error("Could not open the -j file");
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"perfindex\": %.2f,\n", perfindex);
+    fprintf(fp, "  \"traces\": [\n");
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "    {\"trace\": \"%s\", \"valid\": %d, \"ops\": %.0f, "
+		"\"util\": %.6f, \"runs\": %d, \"secs\": %.9g, \"mad\": %.9g, "
+		"\"ci_lo\": %.9g, \"ci_hi\": %.9g, \"min\": %.9g, \"max\": %.9g}%s\n",
+		tracefiles[i], stats[i].valid, stats[i].ops, stats[i].util,
+		stats[i].timing.n, stats[i].secs, stats[i].timing.mad, 
+		stats[i].timing.lo, stats[i].timing.hi, stats[i].timing.min, 
+		stats[i].timing.max, (i < n-1) ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    if (fclose(fp) != 0)
+	unix_error("Could not write the -j file");
+}
+
+/*
+ * compare_baseline - compare the timing of each trace with the one a
+ *     -j file recorded for it, and return how many got slower. A trace
+ *     is only slower (or faster) if the confidence intervals of the two
+ *     medians don't overlap and the medians differ by over REGRESS_TOL,
+ *     so that run-to-run noise alone can't fail the comparison.
+ */
+static int compare_baseline(char *path, int n, char **tracefiles, 
+			    stats_t *stats)
+{
+    FILE *fp;
+    char line[MAXLINE], name[MAXLINE], *p, *verdict;
+    double secs, lo, hi, valid, change;
+    int i, found, slower = 0;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	unix_error("Could not open the -b file");
+
+    printf("\nTimings against %s:\n", path);
+    printf("%5s%12s%12s%9s  %s\n", "trace", "base", "now", "change", "verdict");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+
+	/* Find the line for the trace with the same name */
+	found = 0;
+	rewind(fp);
+	while (!found && (fgets(line, MAXLINE, fp) != NULL)) {
+	    if (((p = strstr(line, "\"trace\": \"")) == NULL) ||
+		(sscanf(p + 10, "%[^\"]", name) != 1) || 
+		strcmp(name, tracefiles[i]))
+		continue;
+	    found = json_number(line, "valid", &valid) && (valid != 0) &&
+		json_number(line, "secs", &secs) &&
+		json_number(line, "ci_lo", &lo) && json_number(line, "ci_hi", &hi);
+	}
+	if (!found) {
+	    printf("%2d%15s%12.6f%9s  %s\n", i, "-", stats[i].secs, "-", "new");
+	    continue;
+	}
+
+	change = (stats[i].secs - secs) / secs;
+	if ((stats[i].timing.lo > hi) && (change > REGRESS_TOL)) {
+	    verdict = "slower";
+	    slower++;
+	}
+	else if ((stats[i].timing.hi < lo) && (change < -REGRESS_TOL))
+	    verdict = "faster";
+	else
+	    verdict = "same";
+	printf("%2d%15.6f%12.6f%+8.1f%%  %s\n", i, secs, stats[i].secs, 
+	       100.0*change, verdict);
+    }
+    fclose(fp);
+
+    if (slower > 0)
+	printf("%d trace(s) slower than the baseline\n", slower);
+    return slower;
+}
+
+/*
+ * json_number - find "key": <number> in a line of a -j file
+ */
+static int json_number(char *line, char *key, double *val)
+{
+    char pat[MAXLINE], *p, *end;
+
+    sprintf(pat, "\"%s\": ", key);
+    if ((p = strstr(line, pat)) == NULL)
+	return 0;
+    *val = strtod(p + strlen(pat), &end);
+    return end != p + strlen(pat);
+}
+
+/*
+ * set_backing - set memlib's backing store options (see mem_setopt) from
+ *    a -M list such as "thp,prefault,node1"; returns -1 if it is bad
+ */
+static int set_backing(char *spec)
+{
+    char *opt, *end;
+    int err = 0;
+
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+	if (!strcmp(opt, "thp"))
+	    err |= mem_setopt(MEM_HUGE, MEM_HUGE_THP);
+	else if (!strcmp(opt, "hugetlb"))
+	    err |= mem_setopt(MEM_HUGE, MEM_HUGE_TLB);
+	else if (!strcmp(opt, "prefault"))
+	    err |= mem_setopt(MEM_PREFAULT, 1);
+	else if (!strcmp(opt, "local"))
+	    err |= mem_setopt(MEM_NODE, MEM_NODE_LOCAL);
+	else if (!strncmp(opt, "node", 4) && (opt[4] != '\0')) {
+	    int node = strtol(opt + 4, &end, 10);
+	    err |= (*end != '\0') || mem_setopt(MEM_NODE, node);
+	}
+	else
+	    err = -1;
+    }
+    return err ? -1 : 0;
+}
+
+/*
+ * printlatresults - prints the latency percentiles (in cycles) of each
+ *    type of op in each valid trace, as measured by eval_lat
+ */
+static void printlatresults(int n, stats_t *stats)
+{
+    static char *names[LAT_TYPES] = {"malloc", "free", "realloc", "all"};
+    int i, j;
+
+    printf("\nLatency by op type (cycles):\n");
+    printf("%5s%9s%8s%8s%8s%8s%8s\n", 
+	   "trace", "op", "ops", "p50", "p90", "p99", "max");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid || (stats[i].lat == NULL))
+	    continue;
+	for (j = 0; j < LAT_ALL; j++) {
+	    if (stats[i].lat[j].n == 0)
+		continue;
+	    printf("%2d%12s%8.0f", i, names[j], stats[i].lat[j].n);
+	    printlat(&stats[i].lat[j]);
+	    printf("\n");
+	}
+    }
+}
+
+/*
+ * printcounters - prints mm's event counters (see mm_stats) for each 
+ *    valid trace, as counted during its utilization replay
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    int i;
+    mm_stats_t *c;
+
+    printf("\nAllocator counters:\n");
+    printf("%5s%8s%8s%6s%8s%7s%7s%7s%7s%6s%6s%8s%8s%5s%7s%6s\n", 
+	   "trace", "fits", "steps", "miss", "splits", "c-none", "c-prev", 
+	   "c-next", "c-both", "grows", "trims", "slab", "tcache", "map",
+	   "quick", "sweep");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	c = &stats[i].counters;
+	printf("%2d%11lu%8lu%6lu%8lu%7lu%7lu%7lu%7lu%6lu%6lu%8lu%8lu%5lu%7lu%6lu\n", 
+	       i, c->fits, c->fit_steps, c->fit_misses, c->splits, 
+	       c->coalesce[0], c->coalesce[1], c->coalesce[2], c->coalesce[3],
+	       c->grows, c->trims, c->slab_mallocs, c->tcache_hits, c->maps,
+	       c->quick_hits, c->sweeps);
+    }
+}
+
+/*
+ * printlat - prints the p50, p90, p99 and max columns for one histogram
+ */
+static void printlat(hist_t *h)
+{
+    printf("%8.0f%8.0f%8.0f%8.0f", 
+	   lat_percentile(h, 0.50), 
+	   lat_percentile(h, 0.90), 
+	   lat_percentile(h, 0.99), 
+	   h->max);
+}
+
+/*
+ * printmtresults - prints the multi-threaded replay results of mm and
+ *    libc malloc, for n traces and m thread counts per trace. Aggregate
+ *    Kops counts the ops of all threads over the wall time, per-thread
+ *    Kops is the average rate of a single thread.
+ */
+static void printmtresults(int n, int m, mtstats_t *mm, mtstats_t *libc) 
+{
+    int i, j, threads;
+    mtstats_t *p, *q;
+    double ops, mmsecs, libcsecs;
+
+    printf("%5s%5s%10s%10s%11s%11s%8s\n", 
+	   "trace", "thr", "mm Kops", "mm K/thr", "libc Kops", "libc K/thr",
+	   "mm/libc");
+    for (i=0; i < n; i++) {
+	for (j=0; j < m; j++) {
+	    p = &mm[i*m + j];
+	    q = &libc[i*m + j];
+	    if (p->threads == 0)
+		continue;
+	    printf("%2d%8d%10.0f%10.0f%11.0f%11.0f%8.2f\n", 
+		   i,
+		   p->threads,
+		   (p->ops/1e3)/p->secs,
+		   (p->ops/1e3)/p->tsecs,
+		   (q->ops/1e3)/q->secs,
+		   (q->ops/1e3)/q->tsecs,
+		   q->secs/p->secs);
+	}
+    }
+
+    /* Print the aggregate scaling curve over all traces */
+    for (j=0; j < m; j++) {
+	ops = mmsecs = libcsecs = 0;
+	threads = 0;
+	for (i=0; i < n; i++) {
+	    if (mm[i*m + j].threads == 0)
+		continue;
+	    threads = mm[i*m + j].threads;
+	    ops += mm[i*m + j].ops;
+	    mmsecs += mm[i*m + j].secs;
+	    libcsecs += libc[i*m + j].secs;
+	}
+	if (ops == 0)
+	    continue;
+	printf("%5s%5d%10.0f%10s%11.0f%11s%8.2f\n", 
+	       "Total",
+	       threads,
+	       (ops/1e3)/mmsecs,
+	       "",
+	       (ops/1e3)/libcsecs,
+	       "",
+	       libcsecs/mmsecs);
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,14 +2828,40 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVaBCDHlLSX] [-f <file>] [-t <dir>] [-F <n>] [-J <n>] [-K <n>]\n");
+    fprintf(stderr, "               [-M <mem>] [-P <fit>] [-T <n>] [-n <runs>] [-w <runs>]\n");
+    fprintf(stderr, "               [-c <cpu>] [-j <file>] [-b <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-b <file>  Compare timings with a -j file; exit 2 if slower.\n");
+    fprintf(stderr, "\t-B         Replay runs of like allocs and frees as batch calls.\n");
+    fprintf(stderr, "\t-c <cpu>   Pin the timed runs to CPU <cpu>.\n");
+    fprintf(stderr, "\t-C         Check allocs made with mm_calloc are zeroed.\n");
+    fprintf(stderr, "\t-D         Defer coalescing small frees (quick bins).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F <n>     Snapshot the heap every <n> ops into %s.\n", FRAGFILE);
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Count cycles, instructions and cache, TLB and\n");
+    fprintf(stderr, "\t           branch misses per op (implies -v).\n");
+    fprintf(stderr, "\t-J <n>     Check traces in up to <n> processes at once.\n");
+    fprintf(stderr, "\t-K <n>     Check <n> heap blocks with mm_check after every op,\n");
+    fprintf(stderr, "\t           and the whole heap after each trace.\n");
+    fprintf(stderr, "\t-j <file>  Write the per-trace results to <file> as JSON.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-M <mem>   Back the heap with a comma list of: thp or hugetlb\n");
+    fprintf(stderr, "\t           (huge pages), prefault, node<N> or local (bind to\n");
+    fprintf(stderr, "\t           node N, or to the node of each mapping thread).\n");
+    fprintf(stderr, "\t-P <fit>   Placement policy: first, next, best, best<K>\n");
+    fprintf(stderr, "\t           (best fit of the first K blocks that fit) or good\n");
+    fprintf(stderr, "\t           (constant time, from the next larger size range).\n");
+    fprintf(stderr, "\t-L         Report per-op latency percentiles (implies -v).\n");
+    fprintf(stderr, "\t-n <runs>  Time <runs> runs of each trace (default %d).\n", DEFAULT_SAMPLES);
+    fprintf(stderr, "\t-S         Stream traces from disk instead of loading them.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Also replay traces on 1, 2, 4, ... n threads.\n");
+    fprintf(stderr, "\t-w <runs>  Warm up with <runs> untimed runs (default %d).\n", DEFAULT_WARMUP);
+    fprintf(stderr, "\t-X         Run the scaling suite (make scaling-traces) instead.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -2,7 +2,18 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            Besides the sbrk heap, it hands out separately mapped
+ *            regions (mem_map) for large blocks, and tracks them so the
+ *            driver can check payloads against them and so that they are
+ *            unmapped when the heap is reset. The sbrk and region calls
+ *            are serialized so that allocator threads may share them.
+ *
+ *            How the memory is backed can be set with mem_setopt: huge
+ *            pages, faulting it all in up front, and binding it to a
+ *            NUMA node (see memlib.h).
  */
+#define _GNU_SOURCE /* for mremap, MAP_HUGETLB and getcpu */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,28 +21,236 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include "memlib.h"
 #include "config.h"
 
+#define HUGE_PAGE (2*(1<<20)) /* huge page size the heap is aligned to */
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2          /* from <linux/mempolicy.h> */
+#endif
+#define MAX_NODES 1024       /* nodes an mbind node mask can name */
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_clean;      /* heap above this was never handed out */
+static size_t mem_mapped;    /* bytes in mapped regions */
+static size_t mem_peak;      /* high water mark of heap plus mapped bytes */
+
+/* a mapped region */
+typedef struct {
+    char *lo;                /* first byte of region */
+    size_t size;             /* size of region in bytes */
+    size_t used;             /* bytes of it counted as mapped */
+} region_t;
+
+static region_t *mem_regions; /* currently mapped regions */
+static int mem_nregions;      /* number of entries in mem_regions */
+static int mem_maxregions;    /* allocated entries in mem_regions */
+
+/* serializes sbrk and region calls from allocator threads */
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* backing store options (mem_setopt) */
+static int mem_huge = MEM_HUGE_NONE; /* page size, one of MEM_HUGE_xxx */
+static int mem_prefault = 0;         /* fault memory in when it is mapped */
+static int mem_node = MEM_NODE_ANY;  /* node to bind memory to */
+
+/*
+ * mem_setopt - set a backing store option, returning 0, or -1 if param
+ *    or value is bad. The heap options take effect at the next mem_init,
+ *    the rest at the next mem_map.
+ */
+int mem_setopt(int param, int value)
+{
+    switch (param) {
+    case MEM_HUGE:
+	if ((value < MEM_HUGE_NONE) || (value > MEM_HUGE_TLB))
+	    return -1;
+	mem_huge = value;
+	return 0;
+    case MEM_PREFAULT:
+	mem_prefault = (value != 0);
+	return 0;
+    case MEM_NODE:
+	if ((value < MEM_NODE_LOCAL) || (value >= MAX_NODES))
+	    return -1;
+	mem_node = value;
+	return 0;
+    }
+    return -1;
+}
+
+/*
+ * mem_bind - bind the pages of lo..lo+size to the node set by MEM_NODE,
+ *    so that wherever they are first touched from they are allocated there
+ */
+static void mem_bind(char *lo, size_t size)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    unsigned long mask[MAX_NODES / (8*sizeof(unsigned long))];
+    unsigned cpu, node = mem_node;
+
+    if (mem_node == MEM_NODE_ANY)
+	return;
+    if ((mem_node == MEM_NODE_LOCAL) &&
+	(syscall(SYS_getcpu, &cpu, &node, NULL) != 0))
+	return;
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8*sizeof(unsigned long))] =
+	1UL << (node % (8*sizeof(unsigned long)));
+    /* the kernel takes one bit fewer than maxnode says */
+    if (syscall(SYS_mbind, lo, size, MPOL_BIND, mask, MAX_NODES + 1, 0) != 0)
+	fprintf(stderr, "WARNING: mem_bind: could not bind to node %u: %s\n",
+		node, strerror(errno));
+#else
+    (void)lo; (void)size;
+#endif
+}
+
+/*
+ * mem_fault - with MEM_PREFAULT, fault in the whole pages from lo to
+ *    lo+size by storing a zero to each, so they still read as zeroed
+ */
+static void mem_fault(char *lo, size_t size)
+{
+    size_t page = mem_pagesize();
+    char *end = lo + size;
+    volatile char *p;
+
+    if (!mem_prefault)
+	return;
+    lo = (char *)(((uintptr_t)lo + page - 1) & ~(uintptr_t)(page - 1));
+    for (p = lo; p < end; p += page)
+	*p = 0;
+}
+
+/*
+ * mem_back - apply the backing store options to freshly mapped memory
+ *    from lo to lo+size: bind it, ask for transparent huge pages if thp
+ *    is set, and fault it in if fault is set (see mem_fault). A partial
+ *    first page is left as it is, as it was backed along with the rest
+ *    of its region.
+ */
+static void mem_back(char *lo, size_t size, int thp, int fault)
+{
+    size_t page = mem_pagesize();
+    char *end = lo + size;
+
+    /* only whole pages can be bound or advised */
+    lo = (char *)(((uintptr_t)lo + page - 1) & ~(uintptr_t)(page - 1));
+    if (lo >= end)
+	return;
+    size = end - lo;
+    mem_bind(lo, size);
+#ifdef MADV_HUGEPAGE
+    if (thp)
+	madvise(lo, size, MADV_HUGEPAGE);
+#else
+    (void)thp;
+#endif
+    if (fault)
+	mem_fault(lo, size);
+}
+
+/*
+ * mem_map_heap - map the storage we will use to model the available VM,
+ *    with the MEM_HUGE page size. Explicit huge pages come from the
+ *    system's reserved pool, so they fall back to transparent ones if
+ *    the pool is too small; transparent huge pages want the heap aligned
+ *    to a huge page, so it is carved out of a larger mapping.
+ */
+static char *mem_map_heap(void)
+{
+    char *lo, *aligned;
+
+#ifdef MAP_HUGETLB
+    if (mem_huge == MEM_HUGE_TLB) {
+	/* no MAP_NORESERVE: without a reservation a fault past the
+	   pool would be a SIGBUS rather than a failed mmap */
+	lo = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (lo != MAP_FAILED) {
+	    mem_back(lo, MAX_HEAP, 0, 1);
+	    return lo;
+	}
+	fprintf(stderr, "WARNING: mem_init: no explicit huge pages (%s), "
+		"using transparent ones\n", strerror(errno));
+    }
+#endif
+    if (mem_huge == MEM_HUGE_NONE) {
+	lo = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (lo != MAP_FAILED)
+	    mem_back(lo, MAX_HEAP, 0, 1);
+	return lo;
+    }
+
+    lo = mmap(NULL, MAX_HEAP + HUGE_PAGE, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (lo == MAP_FAILED)
+	return lo;
+    aligned = (char *)(((uintptr_t)lo + HUGE_PAGE - 1) &
+		       ~(uintptr_t)(HUGE_PAGE - 1));
+    if (aligned > lo)
+	munmap(lo, aligned - lo);
+    munmap(aligned + MAX_HEAP, lo + HUGE_PAGE - aligned);
+    mem_back(aligned, MAX_HEAP, 1, 1);
+    return aligned;
+}
+
+/*
+ * mem_update_peak - record the current memory footprint if it is the
+ *    largest so far
+ */
+static void mem_update_peak(void)
+{
+    size_t size = mem_heapsize() + mem_mapped;
+
+    if (size > mem_peak)
+	mem_peak = size;
+}
+
+/*
+ * mem_find_region - return index of the region starting at lo, or -1
+ */
+static int mem_find_region(void *lo)
+{
+    int i;
+
+    for (i = 0; i < mem_nregions; i++)
+	if (mem_regions[i].lo == (char *)lo)
+	    return i;
+    return -1;
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    /* map the storage we will use to model the available VM, which
+       starts out zeroed and (unless prefaulted) is only backed once
+       it is touched */
+    mem_start_brk = mem_map_heap();
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
 
     mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_clean = mem_start_brk;
+    mem_mapped = 0;
+    mem_peak = 0;
 }
 
 /* 
@@ -39,35 +258,229 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_start_brk, MAX_HEAP);
+    free(mem_regions);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    unmapping any regions still mapped
  */
 void mem_reset_brk()
 {
+    int i;
+
+    pthread_mutex_lock(&mem_lock);
+    for (i = 0; i < mem_nregions; i++)
+	munmap(mem_regions[i].lo, mem_regions[i].size);
+    mem_nregions = 0;
+    mem_mapped = 0;
     mem_brk = mem_start_brk;
+    mem_peak = 0;
+    pthread_mutex_unlock(&mem_lock);
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, releasing its last -incr bytes.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(ptrdiff_t incr) 
 {
-    char *old_brk = mem_brk;
+    char *old_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    pthread_mutex_lock(&mem_lock);
+    old_brk = mem_brk;
+    if ((incr < 0) && ((mem_brk + incr) < mem_start_brk)) {
+	pthread_mutex_unlock(&mem_lock);
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Heap shrunk below its start...\n");
+	return (void *)-1;
+    }
+    if ((mem_brk + incr) > mem_max_addr) {
+	pthread_mutex_unlock(&mem_lock);
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
     mem_brk += incr;
+    if (mem_brk > mem_clean)
+	mem_clean = mem_brk;
+    mem_update_peak();
+    pthread_mutex_unlock(&mem_lock);
     return (void *)old_brk;
 }
 
+/*
+ * mem_add_region - map a new region of size bytes outside the heap and
+ *    return its (page aligned) start address. A reserved region counts
+ *    as mapped only as far as mem_commit says it is in use.
+ */
+static void *mem_add_region(size_t size, int reserve)
+{
+    char *lo;
+    region_t *regions;
+
+    pthread_mutex_lock(&mem_lock);
+    if (mem_nregions == mem_maxregions) {
+	mem_maxregions = mem_maxregions ? 2*mem_maxregions : 16;
+	regions = realloc(mem_regions, mem_maxregions * sizeof(region_t));
+	if (regions == NULL) {
+	    pthread_mutex_unlock(&mem_lock);
+	    fprintf(stderr, "ERROR: mem_map failed. Region table realloc failed...\n");
+	    return (void *)-1;
+	}
+	mem_regions = regions;
+    }
+
+    lo = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS | (reserve ? MAP_NORESERVE : 0), -1, 0);
+    if (lo == MAP_FAILED) {
+	pthread_mutex_unlock(&mem_lock);
+	fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    /* a reservation is only faulted in as it is committed */
+    mem_back(lo, size, mem_huge != MEM_HUGE_NONE, !reserve);
+    mem_regions[mem_nregions].lo = lo;
+    mem_regions[mem_nregions].size = size;
+    mem_regions[mem_nregions].used = reserve ? 0 : size;
+    mem_nregions++;
+    mem_mapped += mem_regions[mem_nregions-1].used;
+    mem_update_peak();
+    pthread_mutex_unlock(&mem_lock);
+    return (void *)lo;
+}
+
+/*
+ * mem_map - map a new region of size bytes outside the heap and return
+ *    its (page aligned) start address
+ */
+void *mem_map(size_t size)
+{
+    return mem_add_region(size, 0);
+}
+
+/*
+ * mem_reserve - map a region of size bytes, like mem_map, that only
+ *    counts towards the mapped bytes (and so the peak footprint) once
+ *    its use is recorded with mem_commit. A heap of its own can be
+ *    grown in it as the sbrk heap is, counting only what it spans.
+ */
+void *mem_reserve(size_t size)
+{
+    return mem_add_region(size, 1);
+}
+
+/*
+ * mem_commit - record that the first used bytes of the region starting
+ *    at lo are in use, faulting in any newly used pages with
+ *    MEM_PREFAULT; returns 0, or -1 if there is no such region
+ */
+int mem_commit(void *lo, size_t used)
+{
+    size_t old;
+    int i;
+
+    pthread_mutex_lock(&mem_lock);
+    if (((i = mem_find_region(lo)) < 0) || (used > mem_regions[i].size)) {
+	pthread_mutex_unlock(&mem_lock);
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_commit failed. Bad region %p...\n", lo);
+	return -1;
+    }
+    old = mem_regions[i].used;
+    mem_mapped = mem_mapped - old + used;
+    mem_regions[i].used = used;
+    mem_update_peak();
+    pthread_mutex_unlock(&mem_lock);
+    if (used > old)  /* fault in the part that is newly in use */
+	mem_fault((char *)lo + old, used - old);
+    return 0;
+}
+
+/*
+ * mem_unmap - unmap the region starting at lo
+ */
+int mem_unmap(void *lo)
+{
+    int i;
+
+    pthread_mutex_lock(&mem_lock);
+    if ((i = mem_find_region(lo)) < 0) {
+	pthread_mutex_unlock(&mem_lock);
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_unmap failed. No region at %p...\n", lo);
+	return -1;
+    }
+    munmap(mem_regions[i].lo, mem_regions[i].size);
+    mem_mapped -= mem_regions[i].used;
+    mem_regions[i] = mem_regions[--mem_nregions];
+    pthread_mutex_unlock(&mem_lock);
+    return 0;
+}
+
+/*
+ * mem_remap - resize the region starting at lo to size bytes, moving it
+ *    if needed, and return its new start address. The contents are kept
+ *    without copying where the system supports it.
+ */
+void *mem_remap(void *lo, size_t size)
+{
+    int i;
+    char *newlo;
+
+    pthread_mutex_lock(&mem_lock);
+    if ((i = mem_find_region(lo)) < 0) {
+	pthread_mutex_unlock(&mem_lock);
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_remap failed. No region at %p...\n", lo);
+	return (void *)-1;
+    }
+#ifdef MREMAP_MAYMOVE
+    newlo = mremap(lo, mem_regions[i].size, size, MREMAP_MAYMOVE);
+#else
+    newlo = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (newlo != MAP_FAILED) {
+	memcpy(newlo, lo, (size < mem_regions[i].size) ? size : mem_regions[i].size);
+	munmap(lo, mem_regions[i].size);
+    }
+#endif
+    if (newlo == MAP_FAILED) {
+	pthread_mutex_unlock(&mem_lock);
+	fprintf(stderr, "ERROR: mem_remap failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    if (size > mem_regions[i].size)  /* back the part that is new */
+	mem_back(newlo + mem_regions[i].size, size - mem_regions[i].size,
+		 mem_huge != MEM_HUGE_NONE, 1);
+    mem_mapped = mem_mapped - mem_regions[i].used + size;
+    mem_regions[i].lo = newlo;
+    mem_regions[i].size = mem_regions[i].used = size;
+    mem_update_peak();
+    pthread_mutex_unlock(&mem_lock);
+    return (void *)newlo;
+}
+
+/*
+ * mem_in_region - return 1 if the bytes lo..hi lie within a single
+ *    mapped region, 0 otherwise
+ */
+int mem_in_region(void *lo, void *hi)
+{
+    int i, found = 0;
+
+    pthread_mutex_lock(&mem_lock);
+    for (i = 0; (i < mem_nregions) && !found; i++)
+	if (((char *)lo >= mem_regions[i].lo) &&
+	    ((char *)hi < mem_regions[i].lo + mem_regions[i].size))
+	    found = 1;
+    pthread_mutex_unlock(&mem_lock);
+    return found;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -84,6 +497,15 @@ void *mem_heap_hi()
     return (void *)(mem_brk - 1);
 }
 
+/*
+ * mem_heap_clean - return the lowest heap address that mem_sbrk has never
+ *    handed out since mem_init; the heap from there on is still zeroed
+ */
+void *mem_heap_clean()
+{
+    return (void *)mem_clean;
+}
+
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
@@ -92,6 +514,23 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_mapsize() - returns the bytes in currently mapped regions
+ */
+size_t mem_mapsize()
+{
+    return mem_mapped;
+}
+
+/*
+ * mem_peaksize() - returns the largest memory footprint (heap size plus
+ *    mapped regions) in bytes since the heap was last reset
+ */
+size_t mem_peaksize()
+{
+    return mem_peak;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
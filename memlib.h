@@ -1,11 +1,37 @@
 #include <unistd.h>
+#include <stddef.h>
 
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void *mem_sbrk(ptrdiff_t incr);
+void *mem_map(size_t size);
+void *mem_reserve(size_t size);
+int mem_commit(void *lo, size_t used);
+int mem_unmap(void *lo);
+void *mem_remap(void *lo, size_t size);
+int mem_in_region(void *lo, void *hi);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_heap_clean(void);
 size_t mem_heapsize(void);
+size_t mem_mapsize(void);
+size_t mem_peaksize(void);
 size_t mem_pagesize(void);
+int mem_setopt(int param, int value);
+
+/* mem_setopt parameters */
+#define MEM_HUGE     1 /* page size of the heap and mapped regions, one of MEM_HUGE_xxx */
+#define MEM_PREFAULT 2 /* 1 faults memory in as soon as it is mapped */
+#define MEM_NODE     3 /* NUMA node to bind memory to, or one of MEM_NODE_xxx */
+
+/* MEM_HUGE values */
+#define MEM_HUGE_NONE 0 /* base pages */
+#define MEM_HUGE_THP  1 /* transparent huge pages (madvise) */
+#define MEM_HUGE_TLB  2 /* explicit huge pages for the heap, else transparent */
+
+/* MEM_NODE values besides node numbers */
+#define MEM_NODE_ANY   -1 /* wherever memory is first touched (the default) */
+#define MEM_NODE_LOCAL -2 /* node of the CPU that maps it, so that each arena's
+			     region is local to the thread that took it */
 
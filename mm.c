@@ -1,11 +1,72 @@
 /*
- * mm.c - An efficient and simple malloc package using a bidirectional
- * implicit list.
+ * mm.c - An efficient and simple malloc package using segregated explicit
+ * free lists.
  * 
- * In this implementation of malloc, an implicit heap list is made where each 
- * block has both a header an a footer, allowing for bidirectional traversal.
- * This implementation uses next fit to find a free block, in which the list is
- * searched where the previous search finished, allowing for faster fits.
+ * In this implementation of malloc, each block has a header, and free blocks
+ * also have a footer, allowing for bidirectional traversal and constant time
+ * coalescing. Allocated blocks need no footer since each header records
+ * whether the previous block is allocated, so the previous block's footer is
+ * only read when it is free.
+ * Free blocks are additionally kept in size-class buckets, each a doubly
+ * linked list whose links live in the free block's payload. As in TLSF, each
+ * power of two is split into SL_COUNT lists of equal size ranges, and two
+ * levels of bitmaps record which lists are non-empty. A fit is found by
+ * searching the list for the request size first and then taking the head of
+ * the next non-empty larger list, which the bitmaps give with two
+ * find-first-set instructions, so only free blocks of a plausible size are
+ * ever touched; the good fit policy skips the first search, so small
+ * requests are placed in constant time. Free blocks of at least TREE_MIN bytes
+ * go in a treap keyed on (size, address) instead, which finds the smallest,
+ * lowest-addressed large block that fits in O(log n), however many large
+ * fragments there are.
+ *
+ * Free list links are stored as 32-bit offsets from the start of the heap
+ * rather than as pointers, so a free block always fits in the 16 byte
+ * minimum block regardless of the pointer size. Headers stay 32 bits on
+ * 64-bit builds too, as no heap block can outgrow MAX_HEAP; only blocks in
+ * their own mapped region record a full size_t size. Block sizes, and so
+ * payloads, are multiples of ALIGNMENT: 16 bytes on 64-bit builds, 8 on
+ * 32-bit ones.
+ *
+ * Built with SIDE_TABLES, the free blocks of the list size classes are kept
+ * in side tables instead: per class, two dense arrays outside the heap hold
+ * their sizes and heap offsets, and each block records its index there. A
+ * search then scans a class's sizes four at a time with SSE2 (or NEON)
+ * compares, never touching the payload memory of blocks that don't fit.
+ *
+ * Requests of up to SLAB_MAX bytes are served from slabs instead: whole
+ * CHUNKSIZE pages, taken from the heap as ordinary allocated blocks aligned
+ * to a page boundary, carved into fixed-size slots for one size class. Slots
+ * have no header; a page map records which heap pages are slabs and of what
+ * class, and each page keeps its own free slot list plus a bump pointer over
+ * slots that have never been used.
+ *
+ * Requests of at least the mmap threshold bypass the heap altogether: each
+ * gets its own region from mem_map, with a header flagged as mapped, so
+ * freeing it returns the memory at once and resizing it is a mem_remap
+ * rather than a copy.
+ *
+ * Coalescing can be deferred (see mm_setopt): freed blocks of up to a page
+ * then wait, still marked allocated, in quick bins of their exact size, so
+ * a block freed and requested again at the same size is neither merged
+ * nor split. The bins are swept into the free lists, coalescing as they
+ * go, only when a fit fails, before the heap is grown.
+ *
+ * Once the free block at the end of the heap grows past a trim threshold
+ * (see mm_setopt), whole pages of it are given back with a negative
+ * mem_sbrk, so the heap shrinks again after a burst.
+ *
+ * mm_check validates the heap a bounded slice of blocks at a time, keeping
+ * its place in each arena across calls. Built with CANARIES, headers and
+ * footers also carry a tag in their top bits, which is checked whenever a
+ * block is freed, resized or placed.
+ *
+ * All of the above is per arena, so the package is thread-safe. Threads are
+ * handed arenas round robin (the first thread gets the memlib heap, the rest
+ * get mapped regions) and lock only their own arena. Freed small slots go to
+ * a per-thread cache first, so most small malloc/free pairs take no lock,
+ * and blocks freed from another arena are queued on that arena's lock-free
+ * remote free list for it to release.
  *
  * NOTE: This code was largely inspired by the example at the end of 
  * chapter 9.9 of the CSAPP textbook.
@@ -15,9 +76,18 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -41,19 +111,56 @@ team_t team = {
 /* double word size (bytes) */
 #define DWORD 8
 
-/* Default size to extend heap (bytes) */
+/* Round n up to the payload alignment (ALIGNMENT, see config.h) */
+#define ALIGN(n) (((n) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
+
+/* Heap page size: slab pages and trimming work in these units (bytes) */
 #define CHUNKSIZE (1<<12)
 
+/* Adjusted block size for a request of size bytes (header only, aligned) */
+#define ADJUST(size) \
+    (((size) <= (DWORD+HFSIZE)) ? 2*DWORD : ALIGN((size) + HFSIZE))
+
+/* Tag the top bits of every header and footer with a canary derived from
+ * the block size and a per-heap key, which overwritten or forged headers
+ * are unlikely to carry (a zeroed one never does), can be set with
+ * -DCANARIES=1 */
+#ifndef CANARIES
+#define CANARIES 0
+#endif
+#if CANARIES
+#if MAX_HEAP > (1 << 28)
+#error "canaries take the top 4 header bits, so MAX_HEAP must not exceed 256 MB"
+#endif
+#define TAG_MASK 0xf0000000u
+#define TAG(size) ((((((unsigned int)(size) >> 4) ^ canary) * 2654435761u) | \
+                   (1u << 28)) & TAG_MASK)
+#else
+#define TAG_MASK 0u
+#define TAG(size) 0u
+#endif
+
 /* Combines the size and allocated bit into a word (for the header/footer) */
-#define HF(size, alloc) ((size) | (alloc))
+#define HF(size, alloc) ((size) | (alloc) | TAG(size))
+
+/* Header bit set when the previous block is allocated */
+#define PREV_ALLOC 0x2
+
+/* Header bit set for blocks in their own mapped region */
+#define MAPPED 0x4
 
 /* Read and write a word at address a */
 #define READ(a) (*(unsigned int *)(a))
 #define WRITE(a, val) (*(unsigned int *)(a) = (val))
 
 /* Read the size and allocation status of header/footer block at address a */
-#define GET_SIZE(a) (READ(a) & ~0x7)
+#define GET_SIZE(a) (READ(a) & ~(0x7 | TAG_MASK))
 #define GET_ALLOC(a) (READ(a) & 0x1)
+#define GET_PREV_ALLOC(a) (READ(a) & PREV_ALLOC)
+#define GET_MAPPED(a) (READ(a) & MAPPED)
+
+/* True if the header/footer at address a carries the canary of its size */
+#define TAG_OK(a) ((READ(a) & TAG_MASK) == TAG(GET_SIZE(a)))
 
 /* Calculate address of given block's header/footer */
 #define HEAD(ptr) ((char *)(ptr) - HFSIZE)
@@ -63,57 +170,693 @@ team_t team = {
 #define NEXT(ptr) ((char *)(ptr) + GET_SIZE(((char *)(ptr) - HFSIZE)))
 #define PREV(ptr) ((char *)(ptr) - GET_SIZE(((char *)(ptr) - DWORD)))
 
+/* Write a block's header keeping its prev-alloc bit */
+#define WRITE_HEAD(ptr, size, alloc) \
+    WRITE(HEAD(ptr), HF(size, alloc) | GET_PREV_ALLOC(HEAD(ptr)))
+
+/* Set/clear the prev-alloc bit in the header of block at ptr */
+#define SET_PREV_ALLOC(ptr) WRITE(HEAD(ptr), READ(HEAD(ptr)) | PREV_ALLOC)
+#define CLEAR_PREV_ALLOC(ptr) WRITE(HEAD(ptr), READ(HEAD(ptr)) & ~PREV_ALLOC)
+
+/* Number of free block size classes (size_class), powers of two */
+#define NUM_CLASSES 16
+
+/* Classes from TREE_CLASS up, blocks of TREE_MIN bytes or more, are kept in
+ * the size tree rather than in free lists; alloc_page only searches the
+ * tree, so every block that can span a page must be in it */
+#define TREE_CLASS 8
+#define TREE_MIN (1 << (TREE_CLASS + 4))
+#if TREE_MIN > CHUNKSIZE
+#error "TREE_MIN must not exceed CHUNKSIZE"
+#endif
+
+/* Second level lists each class below the tree is split into (a power of
+ * two), and the number of free lists (list_index), which the 32-bit first
+ * level and SL_COUNT-bit second level bitmaps must have room for */
+#define SL_BITS 4
+#define SL_COUNT (1 << SL_BITS)
+#define NUM_LISTS (TREE_CLASS * SL_COUNT)
+#if (TREE_CLASS > 32) || (SL_COUNT > 32)
+#error "the free list bitmaps are 32 bits"
+#endif
+
+/* Convert between free block pointers and heap offsets (0 is NULL) */
+#if MAX_HEAP > 0xffffffff
+#error "MAX_HEAP must fit in the 32-bit heap offsets"
+#endif
+#define OFFSET(ptr) ((ptr) ? (unsigned int)((char *)(ptr) - arena->heapB) : 0)
+#define ADDR(off) ((off) ? arena->heapB + (off) : NULL)
+
+/* Read and write the free list links stored in a free block's payload */
+#define NEXT_FREE(ptr) ADDR(READ(ptr))
+#define PREV_FREE(ptr) ADDR(READ((char *)(ptr) + HFSIZE))
+#define SET_NEXT_FREE(ptr, p) WRITE(ptr, OFFSET(p))
+#define SET_PREV_FREE(ptr, p) WRITE((char *)(ptr) + HFSIZE, OFFSET(p))
+
+/* Keep the list classes' free blocks in side tables rather than in lists
+ * linked through their payloads, can be set with -DSIDE_TABLES=1 */
+#ifndef SIDE_TABLES
+#define SIDE_TABLES 0
+#endif
+
+/* Entries a side table is first mapped with, it doubles when full */
+#define SIDE_MIN 8
+
+/* Index of a free block in its class's side table, kept in its payload,
+ * and the index of a block the table had no room for */
+#define SIDE_INDEX(ptr) (*(unsigned int *)(ptr))
+#define NO_INDEX (~0u)
+
+/* Default placement policy (MM_FIT_xxx), can be set with -DFIT_POLICY=n */
+#ifndef FIT_POLICY
+#define FIT_POLICY MM_FIT_FIRST
+#endif
+
+/* Default number of fitting candidates a bounded best fit considers */
+#define FIT_BOUND 8
+
+/* Coalesce eagerly by default; MM_DEFER_COALESCE (mdriver -D) or
+ * -DDEFER_COALESCE=1 coalesces lazily instead */
+#ifndef DEFER_COALESCE
+#define DEFER_COALESCE 0
+#endif
+
+/* Largest block kept in a quick bin when coalescing is deferred (bytes),
+ * and the number of bins, one per block size */
+#define QUICK_MAX CHUNKSIZE
+#define QUICK_BINS (QUICK_MAX/ALIGNMENT + 1)
+
+/* Size tree child links of a free block (heap offsets), and its treap
+ * priority, a hash of its offset */
+#define LEFT(ptr) ((unsigned int *)(ptr))
+#define RIGHT(ptr) ((unsigned int *)(ptr) + 1)
+#define PRIO(ptr) (OFFSET(ptr) * 2654435761u)
+
+/* Smallest heap extension beyond a request's shortfall (bytes), and the
+ * smallest cap on it; the cap is otherwise 1/GROW_FRAC of the heap */
+#define GROW_MIN (CHUNKSIZE/4)
+#define GROW_MAX (2*CHUNKSIZE)
+#define GROW_FRAC 256
+
+/* Default free heap tail that triggers trimming (bytes) */
+#define TRIM_THRESHOLD (32*CHUNKSIZE)
+
+/* Default request size served from a mapped region (bytes) */
+#define MMAP_THRESHOLD (32*CHUNKSIZE)
+
+/* Largest request size that can be served at all (bytes) */
+#define MAX_REQUEST (PTRDIFF_MAX / 2)
+
+/* Mapped region size for a request of size bytes (header, whole pages) */
+#define MAP_SIZE(size) ((((size) + ALIGNMENT + mem_pagesize() - 1) / \
+                         mem_pagesize()) * mem_pagesize())
+
+/* Start of the region of a mapped block, and the region size stored there
+ * (a size_t, as a region may be larger than a 32-bit header can hold) */
+#define MAP_REGION(ptr) ((char *)(ptr) - ALIGNMENT)
+#define MAP_LEN(ptr) (*(size_t *)MAP_REGION(ptr))
+
+/* Number of arenas, and size of the region of each mapped arena (bytes) */
+#define NUM_ARENAS 8
+#define ARENA_SIZE MAX_HEAP
+
+/* Number of freed slots each thread caches per slab class */
+#define TCACHE_MAX 16
+
+/* True if ptr lies in the heap of arena a, which may be another thread's */
+#define IN_ARENA(a, ptr) \
+    ((__atomic_load_n(&(a)->heapL, __ATOMIC_ACQUIRE) != NULL) && \
+     ((char *)(ptr) >= (a)->heapB) && \
+     ((char *)(ptr) < __atomic_load_n(&(a)->brk, __ATOMIC_ACQUIRE)))
+
+/* Read and write the link in a cached or remotely freed block */
+#define LINK(ptr) (*(void **)(ptr))
+
+/* Moves mm_check's place in the current arena off a block that is merged
+ * into the block at into, as it no longer starts a block */
+#define MERGED(gone, into) \
+    do { \
+        if (arena->check == (char *)(gone)) arena->check = (char *)(into); \
+    } while (0)
+
+/* Largest request served from the slab tier (bytes) */
+#define SLAB_MAX 128
+
+/* Number of slab size classes */
+#if ALIGNMENT == 16
+#define NUM_SLABS 8
+#else
+#define NUM_SLABS 12
+#endif
+
+/* Size of the header at the start of each slab page (bytes), which keeps
+ * the slots after it aligned */
+#define SLAB_HDR ALIGN(5*HFSIZE)
+
+/* Slab page header fields of page pg: free slot list (heap offset),
+ * bump offset within the page, slots in use, and partial page list links */
+#define SLAB_FREE(pg) ((char *)(pg))
+#define SLAB_BUMP(pg) ((char *)(pg) + (1*HFSIZE))
+#define SLAB_USED(pg) ((char *)(pg) + (2*HFSIZE))
+#define SLAB_NEXT(pg) ((char *)(pg) + (3*HFSIZE))
+#define SLAB_PREV(pg) ((char *)(pg) + (4*HFSIZE))
+
+/* True if no slot of page pg with slots of size slot is available */
+#define SLAB_FULL(pg, slot) ((READ(SLAB_FREE(pg)) == 0) && \
+                             (READ(SLAB_BUMP(pg)) + (slot) > CHUNKSIZE))
+
+/* Heap page index of address ptr, and start of that page */
+#define PAGE(ptr) (((char *)(ptr) - arena->heapB) / CHUNKSIZE)
+#define PAGE_START(ptr) (arena->heapB + PAGE(ptr) * CHUNKSIZE)
+
+/* True if ptr is a slot in a slab page; mm_free tests this without the
+ * arena's lock, so the break is read atomically */
+#define IS_SLAB(ptr) \
+    (((char *)(ptr) >= arena->heapB) && \
+     ((char *)(ptr) < __atomic_load_n(&arena->brk, __ATOMIC_ACQUIRE)) && \
+     arena->slab_map[PAGE(ptr)])
+
+/* Slot size of each slab class, all multiples of ALIGNMENT */
+static const unsigned int slab_sizes[NUM_SLABS] = {
+#if ALIGNMENT == 16
+    16, 32, 48, 64, 80, 96, 112, 128
+#else
+    8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128
+#endif
+};
+
+/* Slab class for a request, indexed by the request size in ALIGNMENT units */
+static const unsigned char slab_classes[SLAB_MAX/ALIGNMENT + 1] = {
+#if ALIGNMENT == 16
+    0, 0, 1, 2, 3, 4, 5, 6, 7
+#else
+    0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11, 11
+#endif
+};
+
+/* 
+ * Side table of the free blocks of one list size class (SIDE_TABLES): their
+ * sizes and heap offsets, in that order in one mapped region, newest last.
+ */
+typedef struct {
+    unsigned int *size; //size of each free block, NULL until mapped
+    unsigned int *off; //heap offset of each, after the cap sizes
+    unsigned int n; //number of blocks in the table
+    unsigned int cap; //room for this many
+} side_t;
+
+/* 
+ * An arena is an independent heap with its own lock. Arena 0 is the memlib
+ * heap grown with mem_sbrk, the others live in a reserved region of
+ * ARENA_SIZE bytes each (see mem_reserve), bumping their own break. Blocks
+ * freed by a thread other than the one whose arena they belong to are pushed
+ * onto the owning arena's lock-free remote list, which is drained whenever
+ * that arena is locked.
+ */
+typedef struct {
+    pthread_mutex_t lock; //held while operating on the arena
+    char *heapL; //ptr to first block, NULL until initialized
+    char *heapB; //start of the heap, base for free list offsets
+    char *brk; //end of the heap
+    char *max; //end of the arena's region (mapped arenas)
+    char *clean; //the heap from here on was never handed out, so is zero
+    size_t grow; //current heap extension for requests (bytes)
+    char *rover; //free block after the last next fit, NULL for none
+    void *remote; //stack of blocks freed by other threads
+    void *quick[QUICK_BINS]; //stack of freed, uncoalesced blocks of each size
+    unsigned int nquick; //number of blocks in the quick bins
+    char *check; //next block mm_check looks at, NULL to start a new pass
+#if SIDE_TABLES
+    side_t side[NUM_LISTS]; //free blocks of each free list size range
+#else
+    char *free_lists[NUM_LISTS]; //first free block of each size range
+#endif
+    unsigned int fl_map; //bit per size class with a non-empty list
+    unsigned int sl_map[TREE_CLASS]; //bit per non-empty list of each class
+    unsigned int tree; //root of the size tree of large free blocks (offset)
+    char *slabs[NUM_SLABS]; //first slab page with free slots of each class
+    unsigned char slab_map[ARENA_SIZE/CHUNKSIZE]; //slab class+1 of each page
+} arena_t;
+
+/* 
+ * Per-thread cache of recently freed slab slots of the thread's own arena,
+ * one stack per slab class, used without taking any lock. It is emptied
+ * lazily when mm_init starts a new generation of heaps, and flushed back to
+ * the arena when its thread exits.
+ */
+typedef struct {
+    unsigned int gen; //heap generation the cached slots belong to
+    int count[NUM_SLABS]; //number of cached slots of each class
+    void *head[NUM_SLABS]; //first cached slot of each class
+} tcache_t;
+
 /* Global variables */  
-static char *heapL = 0; //ptr to first block
-static char *trav; //trav for next fit
+static arena_t arenas[NUM_ARENAS] = {
+    [0 ... NUM_ARENAS-1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+static unsigned int generation; //bumped by every mm_init
+static int next_arena; //arena given to the next new thread
+static __thread arena_t *arena; //arena being operated on, its lock is held
+static __thread arena_t *home; //this thread's arena
+static __thread tcache_t tcache; //this thread's cache of freed slots
+static pthread_key_t tcache_key; //destructor flushes an exiting thread's cache
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT; //creates tcache_key
+static int trim_threshold = TRIM_THRESHOLD; //tail size for auto trim, -1 off
+static int mmap_threshold = MMAP_THRESHOLD; //request size to map, -1 off
+static int fit_policy = FIT_POLICY; //placement policy, MM_FIT_xxx
+static int fit_bound = FIT_BOUND; //candidates for MM_FIT_BOUNDED
+static int defer_coalesce = DEFER_COALESCE; //quick bin small frees
+static unsigned int canary; //key of the header canaries, new every mm_init
+static unsigned long mapped_blocks; //blocks in own regions, for mm_heapinfo
+static unsigned long mapped_bytes; //total size of those regions
+
+/* Event counters for mm_stats, compiled away unless MM_STATS is defined */
+#ifdef MM_STATS
+static __thread mm_stats_t counters; //this thread's counts
+#define COUNT(field, n) (counters.field += (n))
+#else
+#define COUNT(field, n) ((void)0)
+#endif
+
+/*
+ * size_class - Returns the size class of a block of size bytes.
+ *  - class i holds blocks of size [2^(i+4), 2^(i+5)), the last class
+ *    holds everything larger
+ */
+static int size_class(size_t size)
+{
+    int class = 0;
+
+    for (size >>= 5; (size > 0) && (class < NUM_CLASSES-1); size >>= 1)
+        class++;
+    return class;
+}
+
+/*
+ * list_index - Returns the free list of a block of size bytes, smaller than
+ * TREE_MIN: list SL_COUNT*class + i holds the i-th SL_COUNT-th of the sizes
+ * of its size class.
+ */
+static int list_index(size_t size)
+{
+    int fl = 31 - __builtin_clz(size); //log2, 4 for the smallest blocks
+
+    return ((fl - 4) << SL_BITS) | ((size >> (fl - SL_BITS)) & (SL_COUNT-1));
+}
+
+/*
+ * next_list - Returns the first non-empty free list from list on, or -1 if
+ * there is none, with one find-first-set in each level of bitmaps.
+ */
+static int next_list(int list)
+{
+    int fl = list >> SL_BITS;
+    unsigned int map;
+
+    if (fl >= TREE_CLASS) return -1;
+    map = arena->sl_map[fl] & (~0u << (list & (SL_COUNT-1)));
+    if (map == 0) { //no list left in this class, take the next class's first
+        map = (fl + 1 < 32) ? arena->fl_map & (~0u << (fl + 1)) : 0;
+        if (map == 0) return -1;
+        fl = __builtin_ctz(map);
+        map = arena->sl_map[fl];
+    }
+    return (fl << SL_BITS) | __builtin_ctz(map);
+}
+
+/*
+ * mark_list - Records in the bitmaps whether free list list is empty.
+ */
+static void mark_list(int list, int empty)
+{
+    int fl = list >> SL_BITS;
+
+    if (empty) {
+        arena->sl_map[fl] &= ~(1u << (list & (SL_COUNT-1)));
+        if (arena->sl_map[fl] == 0) arena->fl_map &= ~(1u << fl);
+    }
+    else {
+        arena->sl_map[fl] |= 1u << (list & (SL_COUNT-1));
+        arena->fl_map |= 1u << fl;
+    }
+}
+
+/*
+ * tree_less - True if free block a orders before free block b in the size
+ * tree: it is smaller, or as big and at a lower address.
+ */
+static int tree_less(char *a, char *b)
+{
+    size_t asize = GET_SIZE(HEAD(a));
+    size_t bsize = GET_SIZE(HEAD(b));
+
+    return (asize < bsize) || ((asize == bsize) && (a < b));
+}
+
+/*
+ * rotate_left - Makes the right child of the node at *link its parent.
+ */
+static void rotate_left(unsigned int *link)
+{
+    char *node = ADDR(*link);
+    char *r = ADDR(*RIGHT(node));
+
+    *RIGHT(node) = *LEFT(r);
+    *LEFT(r) = OFFSET(node);
+    *link = OFFSET(r);
+}
+
+/*
+ * rotate_right - Makes the left child of the node at *link its parent.
+ */
+static void rotate_right(unsigned int *link)
+{
+    char *node = ADDR(*link);
+    char *l = ADDR(*LEFT(node));
+
+    *LEFT(node) = *RIGHT(l);
+    *RIGHT(l) = OFFSET(node);
+    *link = OFFSET(l);
+}
+
+/*
+ * tree_insert - Inserts the free block at ptr into the subtree at *link.
+ *  - descends by (size, address), then rotates the block up while its
+ *    priority beats its parent's
+ */
+static void tree_insert(unsigned int *link, char *ptr)
+{
+    char *node = ADDR(*link);
+
+    if (node == NULL) {
+        *LEFT(ptr) = *RIGHT(ptr) = 0;
+        *link = OFFSET(ptr);
+    }
+    else if (tree_less(ptr, node)) {
+        tree_insert(LEFT(node), ptr);
+        if (PRIO(ADDR(*LEFT(node))) > PRIO(node)) rotate_right(link);
+    }
+    else {
+        tree_insert(RIGHT(node), ptr);
+        if (PRIO(ADDR(*RIGHT(node))) > PRIO(node)) rotate_left(link);
+    }
+}
+
+/*
+ * tree_remove - Unlinks the free block at ptr from the size tree.
+ *  - finds its link by (size, address), so the size must be unchanged
+ *  - rotates it down until it has at most one child, then splices it out
+ */
+static void tree_remove(char *ptr)
+{
+    unsigned int *link = &arena->tree;
+    char *node;
+
+    while ((node = ADDR(*link)) != ptr)
+        link = tree_less(ptr, node) ? LEFT(node) : RIGHT(node);
+
+    while (*LEFT(ptr) && *RIGHT(ptr)) {
+        if (PRIO(ADDR(*LEFT(ptr))) > PRIO(ADDR(*RIGHT(ptr)))) {
+            rotate_right(link);
+            link = RIGHT(ADDR(*link));
+        }
+        else {
+            rotate_left(link);
+            link = LEFT(ADDR(*link));
+        }
+    }
+    *link = *LEFT(ptr) ? *LEFT(ptr) : *RIGHT(ptr);
+}
+
+/*
+ * tree_fit - Returns the smallest, then lowest addressed, free block in
+ * the size tree of at least adj_size bytes, or NULL if none.
+ */
+static void *tree_fit(size_t adj_size)
+{
+    char *node = ADDR(arena->tree);
+    char *best = NULL;
+
+    while (node != NULL) {
+        COUNT(fit_steps, 1);
+        if (GET_SIZE(HEAD(node)) >= adj_size) {
+            best = node;
+            node = ADDR(*LEFT(node));
+        }
+        else node = ADDR(*RIGHT(node));
+    }
+    return best;
+}
+
+#if SIDE_TABLES
+/*
+ * side_push - Appends the free block at ptr to the side table of list.
+ *  - maps the table when first needed and doubles it when full
+ *  - if that fails, leaves the block out: it is only found again once it
+ *    coalesces with a neighbour
+ */
+static void side_push(int list, char *ptr)
+{
+    side_t *t = &arena->side[list];
+    unsigned int *size, cap;
+
+    if (t->n == t->cap) {
+        cap = t->cap ? 2*t->cap : SIDE_MIN;
+        if (t->size == NULL) size = mem_map(2*cap*sizeof(unsigned int));
+        else size = mem_remap(t->size, 2*cap*sizeof(unsigned int));
+        if ((long)size == -1) {
+            SIDE_INDEX(ptr) = NO_INDEX;
+            return;
+        }
+        memmove(size + cap, size + t->cap, t->n*sizeof(unsigned int)); //offsets
+        t->size = size;
+        t->off = size + cap;
+        t->cap = cap;
+    }
+    t->size[t->n] = GET_SIZE(HEAD(ptr));
+    t->off[t->n] = OFFSET(ptr);
+    SIDE_INDEX(ptr) = t->n++;
+}
+
+/*
+ * side_remove - Removes the free block at ptr from the side table of
+ * list, moving the table's last block into its place.
+ */
+static void side_remove(int list, char *ptr)
+{
+    side_t *t = &arena->side[list];
+    unsigned int i = SIDE_INDEX(ptr);
+    char *moved = NULL;
+
+    if (i == NO_INDEX) return;
+    if (i != --t->n) {
+        t->size[i] = t->size[t->n];
+        t->off[i] = t->off[t->n];
+        moved = ADDR(t->off[i]);
+        SIDE_INDEX(moved) = i;
+    }
+    if (ptr == arena->rover) arena->rover = moved; //resume at the same index
+}
+
+/*
+ * side_find - Returns the highest index in [lo, hi] of a block of at least
+ * adj_size bytes in side table t, or -1 if none.
+ *  - compares four sizes at once with SSE2 or NEON, signed compares are
+ *    safe as list class blocks are smaller than TREE_MIN
+ */
+static long side_find(side_t *t, size_t adj_size, long hi, long lo)
+{
+#if defined(__SSE2__)
+    __m128i want = _mm_set1_epi32(adj_size - 1);
+    int mask;
+
+    for (; (hi - 3) >= lo; hi -= 4) {
+        COUNT(fit_steps, 4);
+        mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(
+            _mm_loadu_si128((__m128i *)(t->size + hi - 3)), want)));
+        if (mask) return hi - 3 + (31 - __builtin_clz(mask));
+    }
+#elif defined(__ARM_NEON)
+    uint32x4_t want = vdupq_n_u32(adj_size);
+    uint32x4_t ge;
+
+    for (; (hi - 3) >= lo; hi -= 4) {
+        COUNT(fit_steps, 4);
+        ge = vcgeq_u32(vld1q_u32(t->size + hi - 3), want);
+        if (vgetq_lane_u64(vreinterpretq_u64_u32(ge), 0) |
+            vgetq_lane_u64(vreinterpretq_u64_u32(ge), 1))
+            break; //the loop below finds which
+    }
+#endif
+    for (; hi >= lo; hi--) {
+        COUNT(fit_steps, 1);
+        if (t->size[hi] >= adj_size) return hi;
+    }
+    return -1;
+}
+
+/*
+ * side_release - Unmaps the side tables of arena a, if memlib hasn't
+ * already dropped them with the heap.
+ */
+static void side_release(arena_t *a)
+{
+    int list;
+
+    for (list = 0; list < NUM_LISTS; list++) {
+        if ((a->side[list].size != NULL) &&
+            mem_in_region(a->side[list].size, a->side[list].size))
+            mem_unmap(a->side[list].size);
+        memset(&a->side[list], 0, sizeof(side_t));
+    }
+}
+#endif
+
+/*
+ * insert_free - Pushes the free block at ptr onto the front of its free
+ * list (or side table), or into the size tree if it is large.
+ */
+static void insert_free(void *ptr)
+{
+    size_t size = GET_SIZE(HEAD(ptr));
+    int list;
+#if !SIDE_TABLES
+    char *head;
+#endif
+
+    if (size >= TREE_MIN) {
+        tree_insert(&arena->tree, ptr);
+        return;
+    }
+    list = list_index(size);
+#if SIDE_TABLES
+    side_push(list, ptr);
+    if (arena->side[list].n > 0) mark_list(list, 0);
+#else
+    head = arena->free_lists[list];
+
+    SET_NEXT_FREE(ptr, head);
+    SET_PREV_FREE(ptr, NULL);
+    if (head != NULL) SET_PREV_FREE(head, ptr);
+    else mark_list(list, 0);
+    arena->free_lists[list] = ptr;
+#endif
+}
+
+/*
+ * remove_free - Unlinks the free block at ptr from its free list (or side
+ * table), or from the size tree if it is large.
+ */
+static void remove_free(void *ptr)
+{
+    size_t size = GET_SIZE(HEAD(ptr));
+    int list;
+#if !SIDE_TABLES
+    char *next, *prev;
+#endif
+
+    if (size >= TREE_MIN) {
+        tree_remove(ptr);
+        return;
+    }
+    list = list_index(size);
+#if SIDE_TABLES
+    side_remove(list, ptr);
+    if (arena->side[list].n == 0) mark_list(list, 1);
+#else
+    next = NEXT_FREE(ptr);
+    prev = PREV_FREE(ptr);
+    if (prev != NULL) SET_NEXT_FREE(prev, next);
+    else if ((arena->free_lists[list] = next) == NULL) mark_list(list, 1);
+    if (next != NULL) SET_PREV_FREE(next, prev);
+    if (ptr == arena->rover) arena->rover = next; //keep next fit's place
+#endif
+}
 
 /*
  * coalesce - Boundary coalescing. Returns pointer to coalesced block.
- *  - checks if next/prev blocks are allocated
+ *  - checks if next/prev blocks are allocated, the previous one via the
+ *    prev-alloc bit so its footer is only read when it is free
  *  - runs different cases to coalesce depending on allocation
+ *  - unlinks merged neighbours and inserts the result into its free list
  */
 static void *coalesce(void *ptr) 
 {
-    size_t prev_alloc = GET_ALLOC(FOOT(PREV(ptr)));
+    size_t prev_alloc = GET_PREV_ALLOC(HEAD(ptr));
     size_t next_alloc = GET_ALLOC(HEAD(NEXT(ptr)));
     size_t size = GET_SIZE(HEAD(ptr));
 
     /* if both previous and next allocated */
     if (prev_alloc && next_alloc) {
-        return ptr;
+        COUNT(coalesce[0], 1);
     }
 
     /* if only next is allocated */
     else if (!prev_alloc && next_alloc) {
+        COUNT(coalesce[1], 1);
+        MERGED(ptr, PREV(ptr));
+        remove_free(PREV(ptr));
         size += GET_SIZE(HEAD(PREV(ptr)));
         WRITE(FOOT(ptr), HF(size, 0));
-        WRITE(HEAD(PREV(ptr)), HF(size, 0));
+        WRITE_HEAD(PREV(ptr), size, 0);
         ptr = PREV(ptr);
     }
 
     /* if only previous is allocated */
     else if (prev_alloc && !next_alloc) {
+        COUNT(coalesce[2], 1);
+        MERGED(NEXT(ptr), ptr);
+        remove_free(NEXT(ptr));
         size += GET_SIZE(HEAD(NEXT(ptr)));
-        WRITE(HEAD(ptr), HF(size, 0));
+        WRITE_HEAD(ptr, size, 0);
         WRITE(FOOT(ptr), HF(size,0));
     }
 
     /* if neither is */
    else{
+       COUNT(coalesce[3], 1);
+       MERGED(ptr, PREV(ptr));
+       MERGED(NEXT(ptr), PREV(ptr));
+       remove_free(PREV(ptr));
+       remove_free(NEXT(ptr));
        size += GET_SIZE(HEAD(PREV(ptr))) + GET_SIZE(FOOT(NEXT(ptr)));
-       WRITE(HEAD(PREV(ptr)), HF(size, 0));
        WRITE(FOOT(NEXT(ptr)), HF(size, 0));
+       WRITE_HEAD(PREV(ptr), size, 0);
        ptr = PREV(ptr);
     }
-   
-    if ((trav > (char *)ptr) && (trav < NEXT(ptr))) trav = ptr; //change trav if pointing to coalesced block
 
+    insert_free(ptr);
     return ptr;
 }
 
+/*
+ * arena_sbrk - Extends (or with a negative incr, shrinks) the current
+ * arena's heap by incr bytes, returning the start of the new area.
+ *  - arena 0 uses mem_sbrk, mapped arenas bump within their region
+ *  - a mapped arena's region is reserved, so memlib counts only the part
+ *    its heap spans, as for the sbrk heap
+ */
+static void *arena_sbrk(ptrdiff_t incr)
+{
+    char *old_brk = arena->brk;
+
+    if (arena == &arenas[0]) {
+        if ((old_brk = mem_sbrk(incr)) == (void *)-1) return (void *)-1;
+    }
+    else if (((arena->brk + incr) > arena->max) ||
+             (mem_commit(arena->max - ARENA_SIZE, (arena->brk + incr) -
+                         (arena->max - ARENA_SIZE)) < 0)) {
+        errno = ENOMEM;
+        return (void *)-1;
+    }
+    __atomic_store_n(&arena->brk, old_brk + incr, __ATOMIC_RELEASE);
+    if (arena->brk > arena->clean) arena->clean = arena->brk;
+    return old_brk;
+}
+
 /* 
  * *grow_heap - grows the heap size.
- *  - ensures alignment
+ *  - ensures alignment, and grows by at least a minimum sized block
  *  - adds header/footer for new free block
  *  - moves end header to the end of the grown heap
  *  - coalesces
@@ -121,148 +864,1292 @@ static void *coalesce(void *ptr)
 static void *grow_heap(size_t words) 
 {
     size_t size;
-    size = (words % 2) ? (words+1) * HFSIZE : words * HFSIZE;
+    size = ALIGN(words * HFSIZE);
+    if (size < (2*DWORD)) size = 2*DWORD; //smaller couldn't hold its links
 
-    char *ptr = mem_sbrk(size); //set pointer to start of grown block
+    char *ptr = arena_sbrk(size); //set pointer to start of grown block
     if ((long)ptr == -1) return NULL;
+    COUNT(grows, 1);
+    COUNT(grow_bytes, size);
     
     /* Initialize new block's header/footer and end header */
-    WRITE(HEAD(ptr), HF(size, 0));
+    WRITE_HEAD(ptr, size, 0); //keeps old end header's prev-alloc bit
     WRITE(FOOT(ptr), HF(size, 0));
     WRITE(HEAD(NEXT(ptr)), HF(0, 1)); //new end header
 
     return coalesce(ptr);
 }
 
-/* 
- * fit - Find a fit for a block with size bytes
- * - uses next fit method to search for a fit
- * - first traverses the next part of the heap (not already traversed)
- * - next, it traverses the first half
- * - if still no fit, returns NULL, if any then returns pointer to start of fit
+/*
+ * extend - Grows the current arena's heap for a block of adj_size bytes
+ * that no free block can hold, returning the (coalesced) free block.
+ *  - a free block at the end of the heap already covers part of the
+ *    request, so only the shortfall is needed (none if it covers it all,
+ *    as it may when the placement policy passed it over)
+ *  - the heap is extended by the shortfall or the arena's growth step,
+ *    whichever is larger; each extension doubles the step, up to
+ *    1/GROW_FRAC of the heap (but at least GROW_MAX), so a growing heap
+ *    makes about GROW_FRAC mem_sbrk calls per doubling of its size (a
+ *    fixed cap makes ever more), while its unused tail stays too small
+ *    to cost utilization; a trim (demand has fallen) resets the step to
+ *    GROW_MIN
+ *  - the step stops at the end of the arena's region, so a heap close
+ *    to MAX_HEAP can still take requests that fit
  */
-static void *fit(size_t adj_size)
+static void *extend(size_t adj_size)
 {
-    /* Next fit search */
-    char *origtrav = trav;
+    char *end = arena->brk; //end header's payload
+    char *max = arena->max ? arena->max : (char *)mem_heap_lo() + MAX_HEAP;
+    size_t cap = (size_t)(end - arena->heapB)/GROW_FRAC;
+    size_t room = max - end, need = adj_size, tail = 0;
+    size_t step = (arena->grow < room) ? arena->grow : room;
 
-    /* search from  trav to end */
-    for (; GET_SIZE(HEAD(trav)) > 0; trav = NEXT(trav))
-        if (!GET_ALLOC(HEAD(trav)) && (adj_size <= GET_SIZE(HEAD(trav))))
-            return trav;
+    if (!GET_PREV_ALLOC(HEAD(end))) tail = GET_SIZE(HEAD(PREV(end)));
+    need = (tail < need) ? need - tail : 0; //a tail that fits leaves none
+    if (need < step) need = step;
+    if (cap < GROW_MAX) cap = GROW_MAX;
+    if (arena->grow < cap)
+        arena->grow = (2*arena->grow < cap) ? 2*arena->grow : cap;
+    return grow_heap((need + HFSIZE - 1)/HFSIZE);
+}
 
-    /* search from start to orig trav */
-    for (trav = heapL; trav < origtrav; trav = NEXT(trav))
-        if (!GET_ALLOC(HEAD(trav)) && (adj_size <= GET_SIZE(HEAD(trav))))
-            return trav;
+/*
+ * quick_take - Pops a block of exactly adj_size bytes off its quick bin,
+ * or returns NULL if there is none.
+ *  - the block is still marked allocated, so it is ready for use as it is
+ */
+static void *quick_take(size_t adj_size)
+{
+    void **bin;
+    char *ptr;
 
-    return NULL;  /* no fit found */
+    if ((arena->nquick == 0) || (adj_size > QUICK_MAX)) return NULL;
+    bin = &arena->quick[adj_size/ALIGNMENT];
+    if ((ptr = *bin) == NULL) return NULL;
+    *bin = LINK(ptr);
+    arena->nquick--;
+    COUNT(quick_hits, 1);
+    return ptr;
 }
 
-/* 
- * put - Puts size byte block at the free block at ptr, splitting
- * if required.
+/*
+ * sweep_quick - Frees every block in the quick bins for real.
+ *  - blocks in the bins are still marked allocated, so none has merged
+ *    with a neighbour yet; each coalesces with the free ones around it
+ *    as it is freed, so a run of binned blocks ends up one free block
+ *  - returns the number of blocks freed
  */
-static void put(void *ptr, size_t adj_size)
+static unsigned int sweep_quick(void)
 {
-    size_t csize = GET_SIZE(HEAD(ptr));   
+    unsigned int n = arena->nquick;
+    char *ptr, *next;
+    size_t size;
+    int bin;
 
-    if ((csize - adj_size) >= (2*DWORD)) { 
-        WRITE(HEAD(ptr), HF(adj_size, 1));
-        WRITE(FOOT(ptr), HF(adj_size, 1));
-        ptr = NEXT(ptr);
-        WRITE(HEAD(ptr), HF(csize-adj_size, 0));
-        WRITE(FOOT(ptr), HF(csize-adj_size, 0));
-    }
-    else { 
-        WRITE(HEAD(ptr), HF(csize, 1));
-        WRITE(FOOT(ptr), HF(csize, 1));
+    if (n == 0) return 0;
+    COUNT(sweeps, 1);
+    for (bin = 0; bin < QUICK_BINS; bin++) {
+        for (ptr = arena->quick[bin]; ptr != NULL; ptr = next) {
+            next = LINK(ptr);
+            size = GET_SIZE(HEAD(ptr));
+            WRITE_HEAD(ptr, size, 0);
+            WRITE(FOOT(ptr), HF(size, 0));
+            CLEAR_PREV_ALLOC(NEXT(ptr));
+            coalesce(ptr);
+        }
+        arena->quick[bin] = NULL;
     }
+    arena->nquick = 0;
+    return n;
 }
 
-/* 
- * mm_init - initialize the malloc package.
- *  - creates a free heap list of size 16 bytes
- *  - adds a start header/footer
- *  - adds an end header
- *  - moves the pointer to the start of the free space
- *  - extends the heap by CHUNKSIZE bytes
+#if SIDE_TABLES
+/*
+ * first_fit - Returns the newest block of at least adj_size bytes in the
+ * side table of list, or NULL if none.
  */
-int mm_init(void)
-{   
-    /* Create the initial free heap list */
-    if ((heapL = mem_sbrk(4*HFSIZE)) == (void *)-1) return -1;
-    WRITE(heapL, 0); //padding
-    WRITE(heapL + (1*HFSIZE), HF(DWORD, 1)); //start header
-    WRITE(heapL + (2*HFSIZE), HF(DWORD, 1)); //start footer
-    WRITE(heapL + (3*HFSIZE), HF(0, 1)); //end header 
-    heapL += (2*HFSIZE); //move heapL pointer after start header/footer
-
-    trav = heapL; //set trav to point to heap
+static void *first_fit(int list, size_t adj_size)
+{
+    side_t *t = &arena->side[list];
+    long i = side_find(t, adj_size, (long)t->n - 1, 0);
 
-    /* Extend the empty heap list CHUNKSIZE bytes */
-    if (grow_heap(CHUNKSIZE/HFSIZE) == NULL) return -1;
-    return 0;
+    return (i < 0) ? NULL : ADDR(t->off[i]);
 }
 
-/* 
- * mm_malloc - Allocate a block of (at least) size bytes
- * - searches for fit of size bytes
- * - if found, puts the block
- * - if not found, grows heap then puts the block
+/*
+ * class_head - Returns the newest block in the side table of list, or
+ * NULL if it is empty.
  */
-void *mm_malloc(size_t size)
+static void *class_head(int list)
 {
-    char *ptr;
-    size_t adj_size; //adjusted block size
-    size_t growsize; //amount to grow heap, if required
+    side_t *t = &arena->side[list];
 
-    if (heapL == 0) mm_init(); //if no heap list, init
-    if (size == 0) return NULL; //if request is useless, return NULL
+    return (t->n == 0) ? NULL : ADDR(t->off[t->n - 1]);
+}
 
-    if (size <= DWORD) adj_size = 2*DWORD;
-    else adj_size = DWORD * ((size + (DWORD) + (DWORD-1)) / DWORD);
+/*
+ * best_fit - Returns the smallest block of at least adj_size bytes in the
+ * side table of list, or NULL if none.
+ *  - an exact fit ends the search at once
+ *  - with bound > 0, settles for the best of the first bound blocks that fit
+ */
+static void *best_fit(int list, size_t adj_size, int bound)
+{
+    side_t *t = &arena->side[list];
+    long i = (long)t->n - 1, best = -1;
 
-    if ((ptr = fit(adj_size)) != NULL){ //if fit
-        put(ptr, adj_size); //puts block
-        return ptr;
+    for (; (i = side_find(t, adj_size, i, 0)) >= 0; i--) {
+        if ((best < 0) || (t->size[i] < t->size[best])) {
+            best = i;
+            if (t->size[i] == adj_size) break;
+        }
+        if ((bound > 0) && (--bound == 0)) break;
     }
-    /* only runs of no fit */
-    growsize = ((adj_size) > (CHUNKSIZE) ? (adj_size) : (CHUNKSIZE)); //grows heap by CHUNKSIZE or block size, whichever is larger
-    if ((ptr = grow_heap(growsize/HFSIZE)) == NULL) return NULL;
-    put(ptr, adj_size); //puts block
-    return ptr;
+    return (best < 0) ? NULL : ADDR(t->off[best]);
 }
 
 /*
- * mm_free - Frees a block.
- *  - checks for bad entry
- *  - gets size of block to be freed
- *  - updates headers/footers so that block is unallocated
- *  - coalesces
+ * next_fit - Returns the first block of at least adj_size bytes in the
+ * side table of list, scanning down from where the previous next fit
+ * stopped if that was in the same table, or NULL if none.
+ *  - the rover is the block below the last fit, side_remove moves it on
+ *    when that block leaves the table
  */
-void mm_free(void *ptr)
+static void *next_fit(int list, size_t adj_size)
 {
-    if (ptr == 0) return; //if pointer is NULL, return
+    side_t *t = &arena->side[list];
+    long start = (long)t->n - 1, i;
 
-    size_t size = GET_SIZE(HEAD(ptr)); //get size of block to free
-    if (heapL == 0) mm_init(); //if no heap list, init
+    if ((arena->rover != NULL) &&
+        (list_index(GET_SIZE(HEAD(arena->rover))) == list))
+        start = SIDE_INDEX(arena->rover);
 
-    WRITE(HEAD(ptr), HF(size, 0)); //set header to unallocated
-    WRITE(FOOT(ptr), HF(size, 0)); //set footer to unallocated 
-    coalesce(ptr); //coalesce to optimize
+    if (((i = side_find(t, adj_size, start, 0)) < 0) && //wrap around
+        ((i = side_find(t, adj_size, (long)t->n - 1, start + 1)) < 0))
+        return NULL;
+    arena->rover = (i > 0) ? ADDR(t->off[i - 1]) : NULL;
+    return ADDR(t->off[i]);
 }
-
+#else
 /*
- * mm_realloc - reallocates the given area of memory, originally allocated by mm_malloc
+ * first_fit - Returns the first block of at least adj_size bytes in the
+ * free list at index list, or NULL if none.
  */
-void *mm_realloc(void *ptr, size_t size)
+static void *first_fit(int list, size_t adj_size)
 {
-    size_t oldsize;
-    void *newptr;
+    char *ptr;
 
-    /* Handles instance where size = 0, just frees */
-    if(size == 0) {
+    for (ptr = arena->free_lists[list]; ptr != NULL; ptr = NEXT_FREE(ptr)) {
+        COUNT(fit_steps, 1);
+        if (adj_size <= GET_SIZE(HEAD(ptr)))
+            return ptr;
+    }
+    return NULL;
+}
+
+/*
+ * class_head - Returns the first block in the free list at index list, or NULL
+ * if it is empty.
+ */
+static void *class_head(int list)
+{
+    return arena->free_lists[list];
+}
+
+/*
+ * best_fit - Returns the smallest block of at least adj_size bytes in the
+ * free list at index list, or NULL if none.
+ *  - an exact fit ends the search at once
+ *  - with bound > 0, settles for the best of the first bound blocks that fit
+ */
+static void *best_fit(int list, size_t adj_size, int bound)
+{
+    char *ptr, *best = NULL;
+    size_t size, best_size = 0;
+
+    for (ptr = arena->free_lists[list]; ptr != NULL; ptr = NEXT_FREE(ptr)) {
+        COUNT(fit_steps, 1);
+        size = GET_SIZE(HEAD(ptr));
+        if (size < adj_size) continue;
+        if ((best == NULL) || (size < best_size)) {
+            best = ptr;
+            best_size = size;
+            if (size == adj_size) break;
+        }
+        if ((bound > 0) && (--bound == 0)) break;
+    }
+    return best;
+}
+
+/*
+ * next_fit - Returns the first block of at least adj_size bytes in the
+ * free list at index list, starting after the previous next fit if that
+ * stopped in the same list, or NULL if none.
+ *  - the rover is the block after the last fit, remove_free moves it on
+ *    when that block leaves its list
+ */
+static void *next_fit(int list, size_t adj_size)
+{
+    char *start = arena->free_lists[list];
+    char *ptr;
+
+    if ((arena->rover != NULL) &&
+        (list_index(GET_SIZE(HEAD(arena->rover))) == list))
+        start = arena->rover;
+
+    for (ptr = start; ptr != NULL; ptr = NEXT_FREE(ptr)) {
+        COUNT(fit_steps, 1);
+        if (adj_size <= GET_SIZE(HEAD(ptr))) break;
+    }
+    if (ptr == NULL) { //wrap around to the part of the list before start
+        for (ptr = arena->free_lists[list]; ptr != start;
+             ptr = NEXT_FREE(ptr)) {
+            COUNT(fit_steps, 1);
+            if (adj_size <= GET_SIZE(HEAD(ptr))) break;
+        }
+        if (ptr == start) return NULL;
+    }
+    arena->rover = NEXT_FREE(ptr);
+    return ptr;
+}
+#endif
+
+/* 
+ * fit - Find a fit for a block with size bytes
+ * - searches the free list of the request size with the placement policy
+ *   (see mm_setopt): first, next, best or bounded best fit
+ * - if none fits, any block in a larger non-empty list fits, so the head
+ *   of the first such list, which the bitmaps give in constant time, is
+ *   returned (first and next fit) or its smallest block (best fits)
+ * - good fit skips the search, rounding the request up to the next list
+ *   instead, so that small requests never walk a list; only when no
+ *   larger block is free does it search the request's own list after all
+ * - large requests, and small ones no list can hold, take the best fit in
+ *   the size tree whatever the policy, since that costs no more
+ * - if nothing fits, sweeps the quick bins (deferred coalescing) and
+ *   searches again
+ * - if still no fit, returns NULL, if any then returns pointer to start of fit
+ */
+static void *fit(size_t adj_size)
+{
+    int bound = (fit_policy == MM_FIT_BOUNDED) ? fit_bound : 0;
+    int list, fl;
+    char *ptr;
+
+    COUNT(fits, 1);
+    if (adj_size >= TREE_MIN) goto tree;
+    list = list_index(adj_size);
+
+    /* search the request's own list */
+    switch (fit_policy) {
+    case MM_FIT_NEXT:
+        if ((ptr = next_fit(list, adj_size)) != NULL) return ptr;
+        break;
+    case MM_FIT_BEST:
+    case MM_FIT_BOUNDED:
+        if ((ptr = best_fit(list, adj_size, bound)) != NULL) return ptr;
+        break;
+    case MM_FIT_GOOD: //every block in the rounded up request's list fits
+        fl = 31 - __builtin_clz(adj_size);
+        if (adj_size + (1u << (fl - SL_BITS)) - 1 >= TREE_MIN) goto tree;
+        list = list_index(adj_size + (1u << (fl - SL_BITS)) - 1) - 1;
+        break;
+    default:
+        if ((ptr = first_fit(list, adj_size)) != NULL) return ptr;
+    }
+
+    /* take a block of the first larger non-empty list */
+    if ((list = next_list(list + 1)) >= 0) {
+        if ((fit_policy == MM_FIT_BEST) || (fit_policy == MM_FIT_BOUNDED))
+            return best_fit(list, adj_size, bound);
+        COUNT(fit_steps, 1);
+        return class_head(list);
+    }
+
+ tree:
+    if ((ptr = tree_fit(adj_size)) != NULL) return ptr;
+    if ((fit_policy == MM_FIT_GOOD) && (adj_size < TREE_MIN) &&
+        ((ptr = first_fit(list_index(adj_size), adj_size)) != NULL))
+        return ptr; //rounding up skipped the request's own list
+    if (sweep_quick() > 0) return fit(adj_size);
+    COUNT(fit_misses, 1);
+    return NULL;  /* no fit found */
+}
+
+#if CANARIES
+/*
+ * canary_check - Aborts unless the block at ptr looks intact to op.
+ *  - its header must carry the canary of its size and the expected
+ *    allocated and mapped bits, so a forged pointer or a write over the
+ *    header from the block before is caught
+ *  - a heap block must also end within the heap, before a header that
+ *    carries its canary (a write past the end of the block clobbers
+ *    it), and a free block's footer must match its header
+ */
+static void canary_check(void *ptr, unsigned int bits, const char *op)
+{
+    char *head = HEAD(ptr);
+    int ok = TAG_OK(head) && ((READ(head) & (0x1 | MAPPED)) == bits);
+
+    if (ok && !(bits & MAPPED))
+        ok = (NEXT(ptr) <= arena->brk) && TAG_OK(HEAD(NEXT(ptr))) &&
+             ((bits & 0x1) || (READ(FOOT(ptr)) == (READ(head) & ~PREV_ALLOC)));
+    if (!ok) {
+        fprintf(stderr, "%s: heap corruption at %p\n", op, ptr);
+        abort();
+    }
+}
+#define CANARY_CHECK(ptr, bits, op) canary_check(ptr, bits, op)
+#else
+#define CANARY_CHECK(ptr, bits, op) ((void)0)
+#endif
+
+/* 
+ * put - Puts size byte block at the free block at ptr, splitting
+ * if required.
+ *  - removes the block from its free list
+ *  - the split remainder is inserted into the list for its size
+ *  - otherwise marks the next block's previous block as allocated
+ */
+static void put(void *ptr, size_t adj_size)
+{
+    size_t csize = GET_SIZE(HEAD(ptr));   
+
+    CANARY_CHECK(ptr, 0, "mm_malloc");
+    remove_free(ptr);
+    if ((csize - adj_size) >= (2*DWORD)) { 
+        COUNT(splits, 1);
+        WRITE_HEAD(ptr, adj_size, 1);
+        ptr = NEXT(ptr);
+        WRITE(HEAD(ptr), HF(csize-adj_size, 0) | PREV_ALLOC);
+        WRITE(FOOT(ptr), HF(csize-adj_size, 0));
+        insert_free(ptr);
+    }
+    else { 
+        WRITE_HEAD(ptr, csize, 1);
+        SET_PREV_ALLOC(NEXT(ptr));
+    }
+}
+
+/*
+ * place - Allocates a block of adj_size bytes in the current arena, growing
+ * the heap if no free block fits; returns NULL if the heap is exhausted.
+ *  - a block of the same size waiting in a quick bin is reused first
+ */
+static void *place(size_t adj_size)
+{
+    char *ptr;
+
+    if ((ptr = quick_take(adj_size)) != NULL) return ptr;
+    if ((ptr = fit(adj_size)) == NULL) //if no fit
+        ptr = extend(adj_size); //grows heap to fit the block
+    if (ptr != NULL) put(ptr, adj_size); //puts block
+    return ptr;
+}
+
+/*
+ * put_batch - Puts n blocks of adj_size bytes back to back at the free
+ * block at ptr, storing their payloads in ptrs.
+ *  - places them as one block, then writes the headers in between, so
+ *    the free block is split (at most) once
+ *  - the free block must hold all n
+ *  - the last block keeps any sliver too small to split off
+ */
+static void put_batch(char *ptr, size_t adj_size, size_t n, void **ptrs)
+{
+    size_t csize, i;
+
+    put(ptr, n * adj_size);
+    csize = GET_SIZE(HEAD(ptr));
+    WRITE_HEAD(ptr, (n == 1) ? csize : adj_size, 1);
+    ptrs[0] = ptr;
+    for (i = 1; i < n; i++) {
+        ptr += adj_size;
+        WRITE(HEAD(ptr), HF((i == n-1) ? csize - i*adj_size : adj_size, 1) |
+              PREV_ALLOC);
+        ptrs[i] = ptr;
+    }
+}
+
+/*
+ * shrink - Trims the allocated block at ptr down to adj_size bytes.
+ *  - the trimmed tail is freed and coalesced if it can hold a block
+ */
+static void shrink(void *ptr, size_t adj_size)
+{
+    size_t csize = GET_SIZE(HEAD(ptr));
+
+    if ((csize - adj_size) >= (2*DWORD)) {
+        WRITE_HEAD(ptr, adj_size, 1);
+        ptr = NEXT(ptr);
+        WRITE(HEAD(ptr), HF(csize-adj_size, 0) | PREV_ALLOC);
+        WRITE(FOOT(ptr), HF(csize-adj_size, 0));
+        CLEAR_PREV_ALLOC(NEXT(ptr));
+        coalesce(ptr);
+    }
+}
+
+/*
+ * trim - Gives free memory at the end of the current arena's heap back.
+ *  - keeps at least pad bytes of the trailing free block
+ *  - releases whole CHUNKSIZE pages, moving the end header down, or the
+ *    whole block if what would be left is too small to be a block
+ *  - returns 1 if the heap was shrunk, 0 otherwise
+ */
+static int trim(size_t pad)
+{
+    char *end = arena->brk; //end header's payload
+    char *ptr;
+    size_t size, release;
+
+    if (GET_PREV_ALLOC(HEAD(end))) return 0; //last block is allocated
+    ptr = PREV(end);
+    size = GET_SIZE(HEAD(ptr));
+    if (size <= pad) return 0;
+
+    release = ((size - pad) / CHUNKSIZE) * CHUNKSIZE;
+    if ((size - release) < (2*DWORD)) release = size;
+    if (release == 0) return 0;
+
+    COUNT(trims, 1);
+    remove_free(ptr);
+    if (release < size) {
+        WRITE_HEAD(ptr, size - release, 0);
+        WRITE(FOOT(ptr), HF(size - release, 0));
+        insert_free(ptr);
+        WRITE(HEAD(NEXT(ptr)), HF(0, 1)); //new end header
+    }
+    else WRITE_HEAD(ptr, 0, 1); //block becomes the end header
+
+    arena_sbrk(-(ptrdiff_t)release);
+    arena->grow = GROW_MIN; //demand has fallen, start growing slowly again
+    return 1;
+}
+
+/*
+ * free_block - Frees a general heap block.
+ *  - with deferred coalescing, a small block just goes on the quick bin
+ *    of its size, still marked allocated (sweep_quick frees it later)
+ *  - updates header/footer so that block is unallocated
+ *  - clears the next block's prev-alloc bit
+ *  - coalesces
+ *  - trims the heap if this leaves too much free space at its end
+ */
+static void free_block(void *ptr)
+{
+    size_t size = GET_SIZE(HEAD(ptr)); //get size of block to free
+
+    CANARY_CHECK(ptr, 1, "mm_free");
+    if (defer_coalesce && (size <= QUICK_MAX)) {
+        LINK(ptr) = arena->quick[size/ALIGNMENT];
+        arena->quick[size/ALIGNMENT] = ptr;
+        arena->nquick++;
+        return;
+    }
+
+    WRITE_HEAD(ptr, size, 0); //set header to unallocated
+    WRITE(FOOT(ptr), HF(size, 0)); //add footer
+    CLEAR_PREV_ALLOC(NEXT(ptr));
+    ptr = coalesce(ptr); //coalesce to optimize
+
+    if ((trim_threshold >= 0) && (GET_SIZE(HEAD(NEXT(ptr))) == 0) &&
+        (GET_SIZE(HEAD(ptr)) > (size_t)trim_threshold))
+        trim(0);
+}
+
+/*
+ * carve - Allocates adj_size bytes at ptr inside the free block at fptr.
+ *  - the part of the free block before ptr is left as a free block
+ *  - the rest is placed as usual, splitting off any remainder
+ */
+static void carve(void *fptr, char *ptr, size_t adj_size)
+{
+    size_t size = GET_SIZE(HEAD(fptr));
+    size_t lead = ptr - (char *)fptr;
+
+    if (lead > 0) {
+        remove_free(fptr);
+        WRITE_HEAD(fptr, lead, 0);
+        WRITE(FOOT(fptr), HF(lead, 0));
+        insert_free(fptr);
+        WRITE(HEAD(ptr), HF(size-lead, 0));
+        WRITE(FOOT(ptr), HF(size-lead, 0));
+        insert_free(ptr);
+    }
+    put(ptr, adj_size);
+}
+
+/*
+ * page_fit - Returns the first page aligned payload address in the free
+ * block at ptr that leaves enough room for a free block before it.
+ */
+static char *page_fit(void *ptr)
+{
+    char *page = PAGE_START((char *)ptr + CHUNKSIZE - 1);
+
+    if ((page != ptr) && ((page - (char *)ptr) < (2*DWORD)))
+        page += CHUNKSIZE;
+    return page;
+}
+
+/*
+ * tree_page_fit - Returns the smallest free block in the subtree at node
+ * that spans an aligned page block of adj_size bytes, or NULL if none.
+ *  - subtrees of blocks too small for adj_size are skipped
+ */
+static char *tree_page_fit(char *node, size_t adj_size)
+{
+    char *ptr;
+
+    if (node == NULL) return NULL;
+    if (GET_SIZE(HEAD(node)) < adj_size)
+        return tree_page_fit(ADDR(*RIGHT(node)), adj_size);
+    if ((ptr = tree_page_fit(ADDR(*LEFT(node)), adj_size)) != NULL) return ptr;
+    if ((page_fit(node) - node) + adj_size <= GET_SIZE(HEAD(node))) return node;
+    return tree_page_fit(ADDR(*RIGHT(node)), adj_size);
+}
+
+/*
+ * alloc_page - Allocates a block whose payload is a whole aligned heap page.
+ *  - searches the size tree for a block spanning an aligned page, again
+ *    after sweeping the quick bins if there is none
+ *  - if none, grows the heap so the trailing block spans one
+ *  - returns the page, or NULL if the heap is exhausted
+ */
+static char *alloc_page(void)
+{
+    size_t adj_size = ADJUST(CHUNKSIZE);
+    size_t avail = 0; //size of free block at end of heap
+    char *ptr, *page;
+    char *end = arena->brk; //end header's payload
+
+    /* only blocks in the size tree are large enough to span a page */
+    if (((ptr = tree_page_fit(ADDR(arena->tree), adj_size)) == NULL) &&
+        (sweep_quick() > 0))
+        ptr = tree_page_fit(ADDR(arena->tree), adj_size);
+    if (ptr != NULL) {
+        page = page_fit(ptr);
+        carve(ptr, page, adj_size);
+        return page;
+    }
+
+    /* grow the heap past an aligned page after the last block */
+    ptr = end;
+    if (!GET_PREV_ALLOC(HEAD(end))) {
+        ptr = PREV(end);
+        avail = GET_SIZE(HEAD(ptr));
+    }
+    page = page_fit(ptr);
+    if (grow_heap(((page - ptr) + adj_size - avail)/HFSIZE) == NULL)
+        return NULL;
+    carve(ptr, page, adj_size);
+    return page;
+}
+
+/*
+ * slab_malloc - Allocates a slot of the given slab class.
+ *  - takes a slot from the first page with free slots, making a new slab
+ *    page if there is none
+ *  - reuses freed slots first, otherwise bumps into unused slots
+ *  - full pages are unlinked from the class's page list
+ */
+static void *slab_malloc(int class)
+{
+    unsigned int slot = slab_sizes[class];
+    char *pg = arena->slabs[class];
+    char *ptr;
+
+    if (pg == NULL) {
+        if ((pg = alloc_page()) == NULL) return NULL;
+        WRITE(SLAB_FREE(pg), 0);
+        WRITE(SLAB_BUMP(pg), SLAB_HDR);
+        WRITE(SLAB_USED(pg), 0);
+        WRITE(SLAB_NEXT(pg), 0);
+        WRITE(SLAB_PREV(pg), 0);
+        arena->slab_map[PAGE(pg)] = class + 1;
+        arena->slabs[class] = pg;
+        COUNT(slab_pages, 1);
+    }
+    COUNT(slab_mallocs, 1);
+
+    if (READ(SLAB_FREE(pg)) != 0) {
+        ptr = ADDR(READ(SLAB_FREE(pg)));
+        WRITE(SLAB_FREE(pg), READ(ptr));
+    }
+    else {
+        ptr = pg + READ(SLAB_BUMP(pg));
+        WRITE(SLAB_BUMP(pg), READ(SLAB_BUMP(pg)) + slot);
+    }
+    WRITE(SLAB_USED(pg), READ(SLAB_USED(pg)) + 1);
+
+    /* unlink page once full, it is always the head */
+    if (SLAB_FULL(pg, slot)) {
+        arena->slabs[class] = ADDR(READ(SLAB_NEXT(pg)));
+        if (arena->slabs[class] != NULL)
+            WRITE(SLAB_PREV(arena->slabs[class]), 0);
+    }
+    return ptr;
+}
+
+/*
+ * slab_free - Frees the slab slot at ptr.
+ *  - pushes the slot onto its page's free slot list
+ *  - relinks the page into its class's page list if it was full
+ *  - returns an empty page to the heap unless it is the class's only page
+ */
+static void slab_free(void *ptr)
+{
+    char *pg = PAGE_START(ptr);
+    int class = arena->slab_map[PAGE(ptr)] - 1;
+    unsigned int slot = slab_sizes[class];
+    char *next, *prev;
+
+    if (SLAB_FULL(pg, slot)) {
+        WRITE(SLAB_NEXT(pg), OFFSET(arena->slabs[class]));
+        WRITE(SLAB_PREV(pg), 0);
+        if (arena->slabs[class] != NULL)
+            WRITE(SLAB_PREV(arena->slabs[class]), OFFSET(pg));
+        arena->slabs[class] = pg;
+    }
+    WRITE(ptr, READ(SLAB_FREE(pg)));
+    WRITE(SLAB_FREE(pg), OFFSET(ptr));
+    WRITE(SLAB_USED(pg), READ(SLAB_USED(pg)) - 1);
+
+    if ((READ(SLAB_USED(pg)) == 0) &&
+        ((arena->slabs[class] != pg) || (READ(SLAB_NEXT(pg)) != 0))) {
+        next = ADDR(READ(SLAB_NEXT(pg)));
+        prev = ADDR(READ(SLAB_PREV(pg)));
+        if (prev != NULL) WRITE(SLAB_NEXT(prev), OFFSET(next));
+        else arena->slabs[class] = next;
+        if (next != NULL) WRITE(SLAB_PREV(next), OFFSET(prev));
+        arena->slab_map[PAGE(pg)] = 0;
+        free_block(pg);
+    }
+}
+
+/*
+ * map_malloc - Allocates a block of size bytes in its own mapped region.
+ *  - the payload starts ALIGNMENT bytes into the region, which hold the
+ *    region size and, just before the payload, a mapped header
+ */
+static void *map_malloc(size_t size)
+{
+    size_t msize = MAP_SIZE(size);
+    char *ptr = mem_map(msize);
+
+    if ((long)ptr == -1) return NULL;
+    COUNT(maps, 1);
+    __atomic_add_fetch(&mapped_blocks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&mapped_bytes, msize, __ATOMIC_RELAXED);
+    ptr += ALIGNMENT;
+    MAP_LEN(ptr) = msize;
+    WRITE(HEAD(ptr), HF(0, 1) | MAPPED);
+    return ptr;
+}
+
+/*
+ * map_realloc - Resizes the mapped block at ptr to hold size bytes.
+ *  - the region is remapped, so the payload is never copied here
+ */
+static void *map_realloc(void *ptr, size_t size)
+{
+    size_t msize = MAP_SIZE(size);
+    char *region = MAP_REGION(ptr);
+
+    CANARY_CHECK(ptr, 1 | MAPPED, "mm_realloc");
+    if (msize == MAP_LEN(ptr)) return ptr;
+    if ((long)(region = mem_remap(region, msize)) == -1) return NULL;
+    ptr = region + ALIGNMENT;
+    __atomic_add_fetch(&mapped_bytes, msize - MAP_LEN(ptr),
+                       __ATOMIC_RELAXED); //old size survives the remap
+    MAP_LEN(ptr) = msize;
+    return ptr;
+}
+
+/*
+ * unmap_block - Unmaps the block at ptr from its own region.
+ */
+static void unmap_block(void *ptr)
+{
+    CANARY_CHECK(ptr, 1 | MAPPED, "mm_free");
+    __atomic_sub_fetch(&mapped_blocks, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&mapped_bytes, MAP_LEN(ptr), __ATOMIC_RELAXED);
+    mem_unmap(MAP_REGION(ptr));
+}
+
+/*
+ * copy_payload - Copies the first n bytes of the payload at src to the
+ * payload at dst, for a block that moves.
+ *  - payloads are ALIGNMENT aligned, so with 16 byte alignment whole
+ *    vectors are moved with aligned SSE2 (or NEON) loads and stores, 32
+ *    bytes at a time with unaligned AVX2 ones when built for it, and only
+ *    the last few bytes go through memcpy
+ */
+static void copy_payload(char *dst, const char *src, size_t n)
+{
+    size_t i = 0;
+
+#if (ALIGNMENT >= 16) && defined(__SSE2__)
+#ifdef __AVX2__
+    for (; (i + 32) <= n; i += 32)
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_loadu_si256((const __m256i *)(src + i)));
+#endif
+    for (; (i + 16) <= n; i += 16)
+        _mm_store_si128((__m128i *)(dst + i),
+                        _mm_load_si128((const __m128i *)(src + i)));
+#elif (ALIGNMENT >= 16) && defined(__ARM_NEON)
+    for (; (i + 16) <= n; i += 16)
+        vst1q_u8((uint8_t *)(dst + i), vld1q_u8((const uint8_t *)(src + i)));
+#endif
+    memcpy(dst + i, src + i, n - i);
+}
+
+/*
+ * init_heap - Initializes the current arena's heap.
+ *  - creates a free heap list of size 16 bytes
+ *  - adds a start header/footer
+ *  - adds an end header
+ *  - empties the segregated free lists and slab page lists
+ *  - leaves the heap empty, extend grows it on demand
+ */
+static int init_heap(void)
+{
+    int class;
+    char *heapL;
+
+    /* Create the initial free heap list */
+    arena->clean = NULL; //memlib knows how much of its heap was ever used
+    if ((heapL = arena_sbrk(4*HFSIZE)) == (void *)-1) return -1;
+    arena->heapB = heapL;
+    if (arena == &arenas[0]) arena->clean = mem_heap_clean();
+    WRITE(heapL, 0); //padding
+    WRITE(heapL + (1*HFSIZE), HF(DWORD, 1)); //start header
+    WRITE(heapL + (2*HFSIZE), HF(DWORD, 1)); //start footer
+    WRITE(heapL + (3*HFSIZE), HF(0, 1) | PREV_ALLOC); //end header 
+    heapL += (2*HFSIZE); //move heapL pointer after start header/footer
+
+#if SIDE_TABLES
+    for (class = 0; class < NUM_LISTS; class++) arena->side[class].n = 0;
+#else
+    for (class = 0; class < NUM_LISTS; class++) arena->free_lists[class] = NULL;
+#endif
+    arena->fl_map = 0;
+    memset(arena->sl_map, 0, sizeof(arena->sl_map));
+    arena->tree = 0;
+    for (class = 0; class < NUM_SLABS; class++) arena->slabs[class] = NULL;
+    memset(arena->slab_map, 0, sizeof(arena->slab_map));
+    arena->remote = NULL;
+    memset(arena->quick, 0, sizeof(arena->quick));
+    arena->nquick = 0;
+    arena->grow = GROW_MIN; //the heap is grown by the first request
+    arena->rover = NULL;
+    arena->check = NULL;
+    __atomic_store_n(&arena->heapL, heapL, __ATOMIC_RELEASE); //for arena_of
+    return 0;
+}
+
+/*
+ * home_arena - Returns the calling thread's arena, handing arenas out to
+ * new threads round robin.
+ */
+static arena_t *home_arena(void)
+{
+    if (home == NULL)
+        home = &arenas[__atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED)
+                       % NUM_ARENAS];
+    return home;
+}
+
+/*
+ * arena_of - Returns the arena whose heap holds ptr, or NULL if ptr is a
+ * block in its own mapped region.
+ */
+static arena_t *arena_of(void *ptr)
+{
+    arena_t *a = home_arena();
+    int i;
+
+    if (IN_ARENA(a, ptr))
+        return a;
+    for (i = 0, a = arenas; i < NUM_ARENAS; i++, a++)
+        if (IN_ARENA(a, ptr))
+            return a;
+    return NULL;
+}
+
+/*
+ * release - Frees the block at ptr in the current arena.
+ */
+static void release(void *ptr)
+{
+    if (IS_SLAB(ptr)) slab_free(ptr);
+    else free_block(ptr);
+}
+
+/*
+ * lock_arena - Locks arena a and makes it the current arena.
+ *  - maps and initializes a mapped arena on first use
+ *  - frees any blocks other threads have queued on its remote list
+ *  - returns -1 if the arena could not be initialized
+ */
+static int lock_arena(arena_t *a)
+{
+    char *ptr, *next;
+
+    pthread_mutex_lock(&a->lock);
+    arena = a;
+
+    if (a->heapL == NULL) {
+        if ((a == &arenas[0]) ||
+            ((long)(a->brk = mem_reserve(ARENA_SIZE)) == -1)) {
+            a->brk = NULL;
+            pthread_mutex_unlock(&a->lock);
+            return -1;
+        }
+        a->max = a->brk + ARENA_SIZE;
+        if (init_heap() < 0) {
+            pthread_mutex_unlock(&a->lock);
+            return -1;
+        }
+    }
+
+    if (__atomic_load_n(&a->remote, __ATOMIC_RELAXED) != NULL) {
+        ptr = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+        for (; ptr != NULL; ptr = next) {
+            next = LINK(ptr);
+            release(ptr);
+        }
+    }
+    return 0;
+}
+
+/*
+ * unlock_arena - Unlocks the current arena.
+ */
+static void unlock_arena(void)
+{
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/*
+ * remote_free - Queues the block at ptr for its arena a to free.
+ */
+static void remote_free(arena_t *a, void *ptr)
+{
+    void *head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+
+    do LINK(ptr) = head;
+    while (!__atomic_compare_exchange_n(&a->remote, &head, ptr, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * tcache_flush - Frees the slots in the calling thread's cache to its arena,
+ * run as the destructor of tcache_key when the thread exits.
+ *  - a cache of an older heap generation holds nothing to free
+ */
+static void tcache_flush(void *unused)
+{
+    char *ptr;
+    int class;
+
+    (void)unused;
+    if ((tcache.gen != generation) || (home == NULL)) return;
+    if (lock_arena(home) < 0) return;
+    for (class = 0; class < NUM_SLABS; class++) {
+        while ((ptr = tcache.head[class]) != NULL) {
+            tcache.head[class] = LINK(ptr);
+            slab_free(ptr);
+        }
+        tcache.count[class] = 0;
+    }
+    unlock_arena();
+}
+
+/*
+ * tcache_key_init - Creates the key whose destructor flushes thread caches.
+ */
+static void tcache_key_init(void)
+{
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+
+/*
+ * addr_order - qsort comparison of two block pointers by address.
+ */
+static int addr_order(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(void * const *)a;
+    uintptr_t y = (uintptr_t)*(void * const *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * resize - Resizes the block at ptr in the current arena in place.
+ *  - slab slots are kept if the new size still fits the slot
+ *  - shrinks in place, splitting off the unused tail
+ *  - grows in place by absorbing the next block if it is free, extending
+ *    the heap when the block (or that free block) is last before the end
+ *  - returns 1 if done, 0 if the block has to move
+ */
+static int resize(void *ptr, size_t size)
+{
+    size_t oldsize;
+    size_t adj_size = ADJUST(size); //adjusted block size
+    size_t avail; //size of block plus free space after it
+    char *next;
+
+    if (IS_SLAB(ptr))
+        return size <= slab_sizes[arena->slab_map[PAGE(ptr)] - 1];
+    CANARY_CHECK(ptr, 1, "mm_realloc");
+    oldsize = GET_SIZE(HEAD(ptr));
+
+    /* Shrinks (or keeps) block in place */
+    if (adj_size <= oldsize) {
+        shrink(ptr, adj_size);
+        return 1;
+    }
+
+    /* Grows into the next block if free */
+    next = NEXT(ptr);
+    avail = oldsize;
+    if (!GET_ALLOC(HEAD(next))) {
+        avail += GET_SIZE(HEAD(next));
+        next = NEXT(next);
+    }
+
+    /* Grows the heap by the shortfall if nothing follows */
+    if ((avail < adj_size) && (GET_SIZE(HEAD(next)) == 0)) {
+        if (grow_heap((adj_size - avail)/HFSIZE) == NULL) return 0;
+        avail = oldsize + GET_SIZE(HEAD(NEXT(ptr))); //may be a little more
+    }
+
+    if (avail < adj_size) return 0;
+
+    next = NEXT(ptr);
+    MERGED(next, ptr);
+    remove_free(next);
+    WRITE_HEAD(ptr, avail, 1);
+    SET_PREV_ALLOC(NEXT(ptr));
+    shrink(ptr, adj_size);
+    return 1;
+}
+
+/* 
+ * mm_init - initialize the malloc package.
+ *  - starts a new heap generation, so per-thread caches are dropped
+ *  - initializes arena 0 on the memlib heap
+ *  - unmaps the other arenas, they are set up again on first use
+ *  - must not run concurrently with any other mm_ call
+ */
+int mm_init(void)
+{   
+    int i;
+
+#ifdef MM_STATS
+    memset(&counters, 0, sizeof(counters));
+#endif
+    generation++;
+    canary = (unsigned int)((uintptr_t)mem_heap_lo() >> 4) ^
+             (generation * 2654435761u);
+    mapped_blocks = mapped_bytes = 0; //memlib dropped all regions with the heap
+#if SIDE_TABLES
+    for (i = 0; i < NUM_ARENAS; i++) side_release(&arenas[i]);
+#endif
+    for (i = 1; i < NUM_ARENAS; i++) {
+        if ((arenas[i].heapL != NULL) &&
+            mem_in_region(arenas[i].heapB, arenas[i].heapB))
+            mem_unmap(arenas[i].heapB);
+        arenas[i].heapL = NULL;
+    }
+
+    arena = &arenas[0];
+    arena->heapL = NULL;
+    arena->brk = (char *)mem_heap_hi() + 1;
+    return init_heap();
+}
+
+/* 
+ * mm_malloc - Allocate a block of (at least) size bytes
+ * - small requests are served from the per-thread cache, then the slab tier
+ * - large requests get their own mapped region
+ * - searches for fit of size bytes in the thread's arena
+ * - if found, puts the block
+ * - if not found, grows heap then puts the block
+ */
+void *mm_malloc(size_t size)
+{
+    char *ptr;
+    size_t adj_size; //adjusted block size
+    int class;
+
+    if (arenas[0].heapL == NULL) mm_init(); //if no heap list, init
+    if (size == 0) return NULL; //if request is useless, return NULL
+    if (size > MAX_REQUEST) { //so size arithmetic can't wrap
+        errno = ENOMEM;
+        return NULL;
+    }
+    COUNT(mallocs, 1);
+
+    if (size <= SLAB_MAX) {
+        class = slab_classes[(size+ALIGNMENT-1)/ALIGNMENT];
+        if ((tcache.gen == generation) &&
+            ((ptr = tcache.head[class]) != NULL)) {
+            tcache.head[class] = LINK(ptr);
+            tcache.count[class]--;
+            COUNT(tcache_hits, 1);
+            return ptr;
+        }
+        if (lock_arena(home_arena()) < 0) return NULL;
+        ptr = slab_malloc(class);
+        unlock_arena();
+        return ptr;
+    }
+    if ((mmap_threshold >= 0) && (size >= (size_t)mmap_threshold))
+        return map_malloc(size);
+
+    adj_size = ADJUST(size);
+    if (lock_arena(home_arena()) < 0) return NULL;
+    ptr = place(adj_size);
+    unlock_arena();
+    return ptr;
+}
+
+/*
+ * mm_calloc - Allocates zeroed space for nmemb objects of size bytes each.
+ *  - fails if the total size overflows
+ *  - small requests are zeroed after mm_malloc, and mapped regions come
+ *    zeroed from mem_map
+ *  - a heap block only needs zeroing below the arena's clean mark as it
+ *    was before the block was placed, plus the two words placing it may
+ *    have written above the mark: the links of a free block grown there,
+ *    and that free block's footer at the end of ours
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    size_t bytes, adj_size;
+    char *ptr, *clean, *foot;
+
+    if ((nmemb != 0) && (size > MAX_REQUEST / nmemb)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    bytes = nmemb * size;
+    if (arenas[0].heapL == NULL) mm_init(); //if no heap list, init
+
+    if ((bytes <= SLAB_MAX) ||
+        ((mmap_threshold >= 0) && (bytes >= (size_t)mmap_threshold))) {
+        if (((ptr = mm_malloc(bytes)) != NULL) && (bytes <= SLAB_MAX))
+            memset(ptr, 0, bytes);
+        return ptr;
+    }
+    COUNT(mallocs, 1);
+
+    adj_size = ADJUST(bytes);
+    if (lock_arena(home_arena()) < 0) return NULL;
+    clean = arena->clean;
+    ptr = place(adj_size);
+    unlock_arena();
+    if (ptr == NULL) return NULL;
+
+    if ((ptr + bytes) <= (clean + DWORD)) memset(ptr, 0, bytes);
+    else {
+        if (ptr < (clean + DWORD)) memset(ptr, 0, (clean + DWORD) - ptr);
+        foot = ptr + GET_SIZE(HEAD(ptr)) - DWORD;
+        if (foot < (ptr + bytes)) memset(foot, 0, (ptr + bytes) - foot);
+    }
+    return ptr;
+}
+
+/*
+ * mm_malloc_batch - Allocates n blocks of size bytes each into ptrs.
+ *  - small requests pop the per-thread cache, then take slab slots under
+ *    a single lock
+ *  - heap blocks come from the quick bin of their size first, then are
+ *    carved back to back, as many as fit, out of each
+ *    free block the fit policy picks, and the rest out of one extension
+ *    of the heap
+ *  - returns the number of blocks allocated, less than n only if memory
+ *    ran out
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs)
+{
+    size_t i = 0, k, adj_size;
+    char *ptr;
+    int class;
+
+    if (arenas[0].heapL == NULL) mm_init(); //if no heap list, init
+    if ((size == 0) || (n == 0)) return 0;
+    if (size > MAX_REQUEST) {
+        errno = ENOMEM;
+        return 0;
+    }
+    COUNT(mallocs, n);
+
+    if (size <= SLAB_MAX) {
+        class = slab_classes[(size+ALIGNMENT-1)/ALIGNMENT];
+        if (tcache.gen == generation)
+            for (; (i < n) && ((ptr = tcache.head[class]) != NULL); i++) {
+                tcache.head[class] = LINK(ptr);
+                tcache.count[class]--;
+                COUNT(tcache_hits, 1);
+                ptrs[i] = ptr;
+            }
+        if ((i < n) && (lock_arena(home_arena()) == 0)) {
+            for (; (i < n) && ((ptr = slab_malloc(class)) != NULL); i++)
+                ptrs[i] = ptr;
+            unlock_arena();
+        }
+        return i;
+    }
+    if ((mmap_threshold >= 0) && (size >= (size_t)mmap_threshold)) {
+        for (; (i < n) && ((ptr = map_malloc(size)) != NULL); i++)
+            ptrs[i] = ptr;
+        return i;
+    }
+
+    adj_size = ADJUST(size);
+    if (n > (MAX_REQUEST / adj_size)) { //so n * adj_size can't wrap
+        errno = ENOMEM;
+        return 0;
+    }
+    if (lock_arena(home_arena()) < 0) return 0;
+    for (; i < n; i += k) {
+        if ((ptr = quick_take(adj_size)) != NULL) {
+            ptrs[i] = ptr;
+            k = 1;
+            continue;
+        }
+        if ((ptr = fit(adj_size)) != NULL) k = GET_SIZE(HEAD(ptr)) / adj_size;
+        else if ((ptr = extend((n-i) * adj_size)) != NULL) k = n - i;
+        else break;
+        if (k > (n - i)) k = n - i;
+        put_batch(ptr, adj_size, k, ptrs + i);
+    }
+    unlock_arena();
+    return i;
+}
+
+/*
+ * mm_free - Frees a block.
+ *  - checks for bad entry
+ *  - unmaps blocks in their own region
+ *  - queues blocks of another thread's arena on its remote list
+ *  - caches slab slots in the per-thread cache while it has room
+ *  - otherwise frees the slot or block in the thread's arena
+ */
+void mm_free(void *ptr)
+{
+    arena_t *a;
+    int class;
+
+    if (ptr == 0) return; //if pointer is NULL, return
+    if (arenas[0].heapL == NULL) mm_init(); //if no heap list, init
+    COUNT(frees, 1);
+
+    if ((a = arena_of(ptr)) == NULL) {
+        unmap_block(ptr);
+        return;
+    }
+    if (a != home) {
+        COUNT(remote_frees, 1);
+        remote_free(a, ptr);
+        return;
+    }
+
+    /* slab pages of a live slot can't change, so no lock is needed */
+    arena = a;
+    if (IS_SLAB(ptr)) {
+        if (tcache.gen != generation) {
+            memset(&tcache, 0, sizeof(tcache));
+            tcache.gen = generation;
+            pthread_once(&tcache_once, tcache_key_init);
+            pthread_setspecific(tcache_key, &tcache); //flush it at exit
+        }
+        class = arena->slab_map[PAGE(ptr)] - 1;
+        if (tcache.count[class] < TCACHE_MAX) {
+            LINK(ptr) = tcache.head[class];
+            tcache.head[class] = ptr;
+            tcache.count[class]++;
+            return;
+        }
+    }
+
+    lock_arena(a);
+    release(ptr);
+    unlock_arena();
+}
+
+/*
+ * mm_free_batch - Frees the n blocks in ptrs (NULL entries are skipped).
+ *  - sorts ptrs by address, so the thread's own blocks are freed under a
+ *    single lock and a run of neighbouring heap blocks is merged into one
+ *    block first, which then coalesces once
+ *  - mapped blocks and those of other arenas are freed as by mm_free,
+ *    and slab slots go straight back to their pages
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t i, j, size;
+    char *ptr;
+    arena_t *a;
+    int locked = 0;
+
+    if (arenas[0].heapL == NULL) mm_init(); //if no heap list, init
+    COUNT(frees, n);
+    qsort(ptrs, n, sizeof(void *), addr_order);
+
+    for (i = 0; i < n; i = j) {
+        j = i + 1;
+        if ((ptr = ptrs[i]) == NULL) continue;
+        if ((a = arena_of(ptr)) == NULL) {
+            unmap_block(ptr);
+            continue;
+        }
+        if (a != home) {
+            COUNT(remote_frees, 1);
+            remote_free(a, ptr);
+            continue;
+        }
+        if (!locked) {
+            lock_arena(a);
+            locked = 1;
+        }
+        if (IS_SLAB(ptr)) {
+            release(ptr);
+            continue;
+        }
+
+        /* absorb the blocks freed right after this one */
+        size = GET_SIZE(HEAD(ptr));
+        for (; (j < n) && (ptrs[j] == ptr + size) && !IS_SLAB(ptrs[j]); j++) {
+            MERGED(ptrs[j], ptr);
+            size += GET_SIZE(HEAD(ptrs[j]));
+        }
+        WRITE_HEAD(ptr, size, 1);
+        release(ptr);
+    }
+    if (locked) unlock_arena();
+}
+
+/*
+ * mm_realloc - reallocates the given area of memory, originally allocated
+ * by mm_malloc
+ *  - mapped blocks are remapped while still above the mmap threshold
+ *  - other blocks are resized in place in their arena if possible
+ *  - otherwise moves the payload to a newly allocated block
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    size_t oldsize;
+    void *newptr;
+    arena_t *a;
+    int done;
+
+    /* Handles instance where size = 0, just frees */
+    if(size == 0) {
         mm_free(ptr);
         return 0;
     }
@@ -271,6 +2158,32 @@ void *mm_realloc(void *ptr, size_t size)
     if(ptr == NULL) {
         return mm_malloc(size);
     }
+    if (size > MAX_REQUEST) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    COUNT(reallocs, 1);
+
+    /* Mapped blocks are remapped, or moved back into the heap */
+    if ((a = arena_of(ptr)) == NULL) {
+        if ((mmap_threshold >= 0) && (size >= (size_t)mmap_threshold))
+            return map_realloc(ptr, size);
+        oldsize = MAP_LEN(ptr) - ALIGNMENT; //payload size
+        if ((newptr = mm_malloc(size)) == NULL) return 0;
+        copy_payload(newptr, ptr, (size < oldsize) ? size : oldsize);
+        unmap_block(ptr);
+        return newptr;
+    }
+
+    if (lock_arena(a) < 0) return 0;
+    done = resize(ptr, size);
+    if (IS_SLAB(ptr)) oldsize = slab_sizes[arena->slab_map[PAGE(ptr)] - 1];
+    else oldsize = GET_SIZE(HEAD(ptr)) - HFSIZE; //payload size
+    unlock_arena();
+    if (done) {
+        COUNT(realloc_inplace, 1);
+        return ptr;
+    }
 
     newptr = mm_malloc(size);
 
@@ -280,12 +2193,482 @@ void *mm_realloc(void *ptr, size_t size)
     }
 
     /* Copies old data. */
-    oldsize = GET_SIZE(HEAD(ptr));
     if(size < oldsize) oldsize = size;
-    memcpy(newptr, ptr, oldsize);
+    copy_payload(newptr, ptr, oldsize);
 
     /* Frees old block. */
     mm_free(ptr);
 
     return newptr;
-}
\ No newline at end of file
+}
+
+/*
+ * mm_trim - Gives free memory at the end of the calling thread's arena
+ * back to memlib, keeping at least pad bytes free.
+ *  - returns 1 if the heap was shrunk, 0 otherwise
+ */
+int mm_trim(size_t pad)
+{
+    int trimmed;
+
+    if (arenas[0].heapL == NULL) return 0;
+    if (lock_arena(home_arena()) < 0) return 0;
+    sweep_quick(); //binned blocks at the end of the heap can go too
+    trimmed = trim(pad);
+    unlock_arena();
+    return trimmed;
+}
+
+/*
+ * mm_setopt - Sets a tunable allocator parameter.
+ *  - MM_TRIM_THRESHOLD: free space at the end of the heap that makes
+ *    mm_free trim the heap (bytes), -1 disables trimming
+ *  - MM_MMAP_THRESHOLD: request size served from its own mapped region
+ *    (bytes), -1 keeps all blocks in the heap
+ *  - MM_FIT_POLICY: how fit places requests in free blocks, MM_FIT_xxx
+ *  - MM_FIT_BOUND: fitting blocks MM_FIT_BOUNDED looks at, at least 1
+ *  - MM_DEFER_COALESCE: 1 keeps freed blocks of up to QUICK_MAX bytes in
+ *    exact-size quick bins, coalescing them only when a fit fails; 0
+ *    coalesces every free at once (blocks already binned stay until the
+ *    next sweep)
+ *  - returns 0 on success, -1 for an unknown parameter or bad value
+ */
+int mm_setopt(int param, int value)
+{
+    switch (param) {
+    case MM_TRIM_THRESHOLD:
+        if (value < -1) return -1;
+        trim_threshold = value;
+        return 0;
+    case MM_MMAP_THRESHOLD:
+        if (value < -1) return -1;
+        mmap_threshold = value;
+        return 0;
+    case MM_FIT_POLICY:
+        if ((value < MM_FIT_FIRST) || (value > MM_FIT_GOOD)) return -1;
+        fit_policy = value;
+        return 0;
+    case MM_FIT_BOUND:
+        if (value < 1) return -1;
+        fit_bound = value;
+        return 0;
+    case MM_DEFER_COALESCE:
+        if ((value < 0) || (value > 1)) return -1;
+        defer_coalesce = value;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * walk_arena - Adds every block of the current arena to the snapshot *info.
+ *  - free blocks are binned by free list size class
+ *  - slab pages count their used slots as allocated, the rest as idle
+ *  - blocks in the quick bins count as free, though they have not
+ *    coalesced yet
+ */
+static void walk_arena(mm_heapinfo_t *info)
+{
+    char *ptr;
+    size_t size, used;
+    int bin;
+
+    info->heap_bytes += arena->brk - arena->heapB;
+    for (ptr = NEXT(arena->heapL); (size = GET_SIZE(HEAD(ptr))) != 0;
+         ptr = NEXT(ptr)) {
+        if (!GET_ALLOC(HEAD(ptr))) {
+            info->free_blocks++;
+            info->free_bytes += size;
+            info->free_hist[size_class(size)]++;
+            if (size > info->largest_free) info->largest_free = size;
+        }
+        else if (IS_SLAB(ptr)) {
+            used = READ(SLAB_USED(ptr)) *
+                   slab_sizes[arena->slab_map[PAGE(ptr)] - 1];
+            info->slab_pages++;
+            info->alloc_blocks += READ(SLAB_USED(ptr));
+            info->alloc_bytes += used;
+            info->slab_idle += size - used;
+        }
+        else {
+            info->alloc_blocks++;
+            info->alloc_bytes += size;
+        }
+    }
+    for (bin = 0; bin < QUICK_BINS; bin++)
+        for (ptr = arena->quick[bin]; ptr != NULL; ptr = LINK(ptr)) {
+            size = GET_SIZE(HEAD(ptr));
+            info->alloc_blocks--;
+            info->alloc_bytes -= size;
+            info->free_blocks++;
+            info->free_bytes += size;
+            info->free_hist[size_class(size)]++;
+            if (size > info->largest_free) info->largest_free = size;
+        }
+}
+
+/*
+ * mm_heapinfo - Takes a snapshot of the whole heap into *info.
+ *  - walks each initialized arena under its lock
+ *  - slots in per-thread caches still count as allocated
+ *  - returns 0, or -1 if there is no heap yet
+ */
+int mm_heapinfo(mm_heapinfo_t *info)
+{
+    int i;
+
+    memset(info, 0, sizeof(*info));
+    if (arenas[0].heapL == NULL) return -1;
+
+    for (i = 0; i < NUM_ARENAS; i++) {
+        if (__atomic_load_n(&arenas[i].heapL, __ATOMIC_ACQUIRE) == NULL)
+            continue;
+        if (lock_arena(&arenas[i]) < 0) continue;
+        walk_arena(info);
+        unlock_arena();
+    }
+    info->mapped_blocks = __atomic_load_n(&mapped_blocks, __ATOMIC_RELAXED);
+    info->mapped_bytes = __atomic_load_n(&mapped_bytes, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*
+ * check_error - Reports the first problem mm_check found, at ptr.
+ *  - returns -1, for the caller to pass on
+ */
+static int check_error(void *ptr, const char *msg)
+{
+    fprintf(stderr, "mm_check: %p: %s\n", ptr, msg);
+    return -1;
+}
+
+/*
+ * in_heap - True if ptr could be the payload of a block in the current
+ * arena's heap, so its header and links may be read.
+ */
+static int in_heap(char *ptr)
+{
+    return (ptr > arena->heapL) && (ptr < arena->brk) &&
+           (((uintptr_t)ptr % ALIGNMENT) == 0);
+}
+
+/*
+ * list_marked - True if the bitmaps say free list list is non-empty.
+ */
+static int list_marked(int list)
+{
+    return (arena->sl_map[list >> SL_BITS] >> (list & (SL_COUNT-1))) & 1;
+}
+
+/*
+ * check_listed - Checks that the free block at ptr, of size bytes, is where
+ * insert_free put it.
+ *  - a list block must be linked both ways with its neighbours (or be the
+ *    head of its list), a side table block must be at its index, and its
+ *    list must be marked non-empty, all in constant time
+ *  - a large block must be found by searching the size tree for it
+ */
+static int check_listed(char *ptr, size_t size)
+{
+    int list;
+
+    if (size >= TREE_MIN) {
+        char *node = ADDR(arena->tree);
+        size_t steps = (arena->brk - arena->heapB) / TREE_MIN; //most nodes
+
+        while (node != ptr) {
+            if ((node == NULL) || !in_heap(node) || (steps-- == 0))
+                return check_error(ptr,
+                                   "free block missing from the size tree");
+            node = ADDR(tree_less(ptr, node) ? *LEFT(node) : *RIGHT(node));
+        }
+        return 0;
+    }
+    list = list_index(size);
+#if SIDE_TABLES
+    side_t *t = &arena->side[list];
+    unsigned int i = SIDE_INDEX(ptr);
+
+    if (i == NO_INDEX) return 0; //its table was full, it waits to coalesce
+    if ((i >= t->n) || (t->off[i] != OFFSET(ptr)) || (t->size[i] != size))
+        return check_error(ptr, "free block not at its side table index");
+#else
+    char *next = NEXT_FREE(ptr), *prev = PREV_FREE(ptr);
+
+    if ((prev == NULL) ? (arena->free_lists[list] != ptr) :
+        (!in_heap(prev) || (NEXT_FREE(prev) != ptr)))
+        return check_error(ptr, "free block not linked into its list");
+    if ((next != NULL) && (!in_heap(next) || (PREV_FREE(next) != ptr)))
+        return check_error(ptr, "next free block does not link back");
+#endif
+    if (!list_marked(list))
+        return check_error(ptr, "free block's list is marked empty");
+    return 0;
+}
+
+/*
+ * check_slab - Checks the header of the slab page at pg and the slots on
+ * its free slot list, which must be exactly the used slots not in use.
+ */
+static int check_slab(char *pg)
+{
+    unsigned int bump = READ(SLAB_BUMP(pg));
+    unsigned int used = READ(SLAB_USED(pg));
+    unsigned int slot, off, nfree = 0;
+
+    if ((pg != PAGE_START(pg)) || (arena->slab_map[PAGE(pg)] > NUM_SLABS))
+        return check_error(pg, "bad slab page");
+    slot = slab_sizes[arena->slab_map[PAGE(pg)] - 1];
+    if ((bump < SLAB_HDR) || (bump > CHUNKSIZE) || ((bump - SLAB_HDR) % slot) ||
+        (used > (bump - SLAB_HDR) / slot))
+        return check_error(pg, "bad slab page header");
+    for (off = READ(SLAB_FREE(pg)); off != 0; off = READ(ADDR(off))) {
+        if ((ADDR(off) < pg + SLAB_HDR) || (ADDR(off) >= pg + bump) ||
+            ((ADDR(off) - pg - SLAB_HDR) % slot) ||
+            (++nfree > (bump - SLAB_HDR) / slot - used))
+            return check_error(pg, "bad slab free slot list");
+    }
+    if (nfree != (bump - SLAB_HDR) / slot - used)
+        return check_error(pg, "slab slots lost from the free slot list");
+    return 0;
+}
+
+/*
+ * check_block - Checks the heap block at ptr.
+ *  - its size, alignment and canary, and that it ends within the heap
+ *  - the next block's prev-alloc bit must agree with its allocated bit
+ *  - a free block's footer must match its header, neither neighbour may
+ *    be free (it would have coalesced), and it must be in its free list
+ *  - a slab page's header and free slots are checked too
+ */
+static int check_block(char *ptr)
+{
+    unsigned int head = READ(HEAD(ptr));
+    size_t size = GET_SIZE(HEAD(ptr));
+    char *next = ptr + size;
+
+    if (((uintptr_t)ptr % ALIGNMENT) != 0)
+        return check_error(ptr, "payload not aligned");
+    if ((size < 2*DWORD) || ((size % ALIGNMENT) != 0) || (head & MAPPED))
+        return check_error(ptr, "bad block header");
+    if (!TAG_OK(HEAD(ptr)))
+        return check_error(ptr, "header canary overwritten");
+    if (next > arena->brk)
+        return check_error(ptr, "block runs past the end of the heap");
+
+    if (GET_ALLOC(HEAD(ptr))) {
+        if (!GET_PREV_ALLOC(HEAD(next)))
+            return check_error(ptr, "next block's prev-alloc bit is clear");
+        return IS_SLAB(ptr) ? check_slab(ptr) : 0;
+    }
+    if (READ(FOOT(ptr)) != (head & ~PREV_ALLOC))
+        return check_error(ptr, "footer does not match header");
+    if (!GET_PREV_ALLOC(HEAD(ptr)) || !GET_ALLOC(HEAD(next)))
+        return check_error(ptr, "free block has a free neighbour");
+    if (GET_PREV_ALLOC(HEAD(next)))
+        return check_error(ptr, "next block's prev-alloc bit is set");
+    return check_listed(ptr, size);
+}
+
+/*
+ * check_maps - Checks the prologue, and that the free list bitmaps agree
+ * with the lists (or side tables), which takes a constant NUM_LISTS steps.
+ */
+static int check_maps(void)
+{
+    int list, fl, empty;
+
+    if ((GET_SIZE(HEAD(arena->heapL)) != DWORD) ||
+        !GET_ALLOC(HEAD(arena->heapL)) || !TAG_OK(HEAD(arena->heapL)))
+        return check_error(arena->heapL, "bad prologue");
+    for (list = 0; list < NUM_LISTS; list++) {
+#if SIDE_TABLES
+        empty = (arena->side[list].n == 0);
+#else
+        empty = (arena->free_lists[list] == NULL);
+#endif
+        if (empty == list_marked(list))
+            return check_error(arena->heapB, "free list bitmap out of date");
+    }
+    for (fl = 0; fl < 32; fl++)
+        if (((arena->fl_map >> fl) & 1) !=
+            ((fl < TREE_CLASS) && arena->sl_map[fl]))
+            return check_error(arena->heapB,
+                               "free list class bitmap out of date");
+    if (arena->tree && !in_heap(ADDR(arena->tree)))
+        return check_error(ADDR(arena->tree), "bad size tree root");
+    return 0;
+}
+
+/*
+ * check_tree - Checks the subtree of the size tree at node, whose blocks
+ * must all order after lo and before hi (NULL for no bound), adding its
+ * nodes to *n, up to max of them (a cycle would exceed it).
+ */
+static int check_tree(char *node, char *lo, char *hi, size_t *n, size_t max)
+{
+    char *left, *right;
+
+    if (node == NULL) return 0;
+    if (!in_heap(node) || (++*n > max))
+        return check_error(node, "bad size tree link");
+    if (GET_ALLOC(HEAD(node)) || (GET_SIZE(HEAD(node)) < TREE_MIN))
+        return check_error(node, "size tree node is not a large free block");
+    if ((lo && !tree_less(lo, node)) || (hi && !tree_less(node, hi)))
+        return check_error(node, "size tree out of order");
+    left = ADDR(*LEFT(node));
+    right = ADDR(*RIGHT(node));
+    if ((left && (PRIO(left) > PRIO(node))) ||
+        (right && (PRIO(right) > PRIO(node))))
+        return check_error(node, "size tree priorities out of order");
+    if (check_tree(left, lo, node, n, max) < 0) return -1;
+    return check_tree(right, node, hi, n, max);
+}
+
+/*
+ * check_arena - Checks the whole current arena.
+ *  - checks every block in the heap, counting the free ones
+ *  - walks every free list (or side table) and the size tree, whose
+ *    entries must be free blocks of their size range and match those
+ *    counts, so none is stale or missing
+ *  - the quick bins must hold nquick allocated blocks of their sizes
+ */
+static int check_arena(void)
+{
+    size_t nlisted = 0, ntree = 0, n = 0, size;
+    unsigned int nquick = 0;
+    char *ptr;
+    int list, bin;
+
+    if (check_maps() < 0) return -1;
+    for (ptr = NEXT(arena->heapL); (size = GET_SIZE(HEAD(ptr))) != 0;
+         ptr = NEXT(ptr)) {
+        if (check_block(ptr) < 0) return -1;
+        if (GET_ALLOC(HEAD(ptr))) continue;
+        if (size >= TREE_MIN) ntree++;
+#if SIDE_TABLES
+        else if (SIDE_INDEX(ptr) != NO_INDEX) nlisted++;
+#else
+        else nlisted++;
+#endif
+    }
+    if (ptr != arena->brk)
+        return check_error(ptr, "end header before the end of the heap");
+
+    for (list = 0; list < NUM_LISTS; list++) {
+#if SIDE_TABLES
+        side_t *t = &arena->side[list];
+        unsigned int i;
+
+        for (i = 0; i < t->n; i++) {
+            ptr = ADDR(t->off[i]);
+            if (!in_heap(ptr) || GET_ALLOC(HEAD(ptr)) ||
+                (SIDE_INDEX(ptr) != i) ||
+                (list_index(GET_SIZE(HEAD(ptr))) != list) || (++n > nlisted))
+                return check_error(ptr, "stale side table entry");
+        }
+#else
+        for (ptr = arena->free_lists[list]; ptr != NULL; ptr = NEXT_FREE(ptr)) {
+            if (!in_heap(ptr) || GET_ALLOC(HEAD(ptr)) ||
+                (GET_SIZE(HEAD(ptr)) >= TREE_MIN) ||
+                (list_index(GET_SIZE(HEAD(ptr))) != list) || (++n > nlisted))
+                return check_error(ptr, "stale free list entry");
+        }
+#endif
+    }
+    if (n != nlisted)
+        return check_error(arena->heapB,
+                           "free blocks missing from the free lists");
+    n = 0;
+    if (check_tree(ADDR(arena->tree), NULL, NULL, &n, ntree) < 0) return -1;
+    if (n != ntree)
+        return check_error(arena->heapB,
+                           "free blocks missing from the size tree");
+
+    for (bin = 0; bin < QUICK_BINS; bin++)
+        for (ptr = arena->quick[bin]; ptr != NULL; ptr = LINK(ptr))
+            if (!in_heap(ptr) || !GET_ALLOC(HEAD(ptr)) ||
+                (GET_SIZE(HEAD(ptr)) != (size_t)bin * ALIGNMENT) ||
+                (++nquick > arena->nquick))
+                return check_error(ptr, "bad quick bin entry");
+    if (nquick != arena->nquick)
+        return check_error(arena->heapB, "quick bin count is wrong");
+    return 0;
+}
+
+/*
+ * check_slice - Checks the next blocks blocks of the current arena, from
+ * where the last slice stopped.
+ *  - once a pass reaches the end of the heap, the bitmaps are checked and
+ *    the next slice starts a new pass
+ *  - blocks merged away since the last slice are accounted for (MERGED),
+ *    so the place kept is always the start of a block
+ */
+static int check_slice(size_t blocks)
+{
+    char *ptr = arena->check ? arena->check : NEXT(arena->heapL);
+
+    for (; blocks > 0; blocks--) {
+        if (GET_SIZE(HEAD(ptr)) == 0) break;
+        if (check_block(ptr) < 0) {
+            arena->check = NULL;
+            return -1;
+        }
+        ptr = NEXT(ptr);
+    }
+    if (GET_SIZE(HEAD(ptr)) != 0) {
+        arena->check = ptr;
+        return 0;
+    }
+    arena->check = NULL; //the pass is done
+    if (ptr != arena->brk)
+        return check_error(ptr, "end header before the end of the heap");
+    return check_maps();
+}
+
+/*
+ * mm_check - Checks the heap for consistency (see mm.h).
+ *  - with blocks 0, checks every arena in full under its lock
+ *  - otherwise checks a slice of blocks blocks of the thread's own arena
+ *  - returns 0 if no problem was found, else -1 having reported it
+ */
+int mm_check(size_t blocks)
+{
+    int i, err = 0;
+
+    if (arenas[0].heapL == NULL) return 0; //no heap yet
+
+    if (blocks > 0) {
+        if (__atomic_load_n(&home_arena()->heapL, __ATOMIC_ACQUIRE) == NULL)
+            return 0;
+        if (lock_arena(home) < 0) return 0;
+        err = check_slice(blocks);
+        unlock_arena();
+        return err;
+    }
+    for (i = 0; (i < NUM_ARENAS) && (err == 0); i++) {
+        if (__atomic_load_n(&arenas[i].heapL, __ATOMIC_ACQUIRE) == NULL)
+            continue;
+        if (lock_arena(&arenas[i]) < 0) continue;
+        err = check_arena();
+        unlock_arena();
+    }
+    return err;
+}
+
+/*
+ * mm_stats - Copies the calling thread's event counters to *stats.
+ *  - counts run from the thread's last mm_init (or its first mm_ call)
+ *  - returns 0, or -1 with *stats zeroed if built without MM_STATS
+ */
+int mm_stats(mm_stats_t *stats)
+{
+#ifdef MM_STATS
+    *stats = counters;
+    return 0;
+#else
+    memset(stats, 0, sizeof(*stats));
+    return -1;
+#endif
+}
@@ -2,8 +2,99 @@
 
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
+extern void *mm_calloc (size_t nmemb, size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_trim(size_t pad);
+
+/* 
+ * Batch calls for many equal-sized blocks at once. mm_malloc_batch
+ * returns how many of the n blocks it allocated into ptrs (fewer only
+ * when out of memory); mm_free_batch reorders ptrs while freeing them.
+ */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **ptrs);
+extern void mm_free_batch(void **ptrs, size_t n);
+
+extern int mm_setopt(int param, int value);
+
+/* 
+ * Allocator event counters of the calling thread, since its last mm_init.
+ * They are only kept when mm.c is built with -DMM_STATS (make STATS=1);
+ * otherwise mm_stats zeroes *stats and returns -1.
+ */
+typedef struct {
+    unsigned long mallocs;         /* mm_malloc calls */
+    unsigned long frees;           /* mm_free calls */
+    unsigned long reallocs;        /* mm_realloc calls */
+    unsigned long realloc_inplace; /* ... resized without moving */
+    unsigned long tcache_hits;     /* small mallocs served by the thread cache */
+    unsigned long slab_mallocs;    /* small mallocs served by a slab page */
+    unsigned long slab_pages;      /* slab pages taken from the heap */
+    unsigned long maps;            /* blocks given their own mapped region */
+    unsigned long remote_frees;    /* frees queued for another thread's arena */
+    unsigned long fits;            /* free list searches */
+    unsigned long fit_steps;       /* free blocks examined by those searches */
+    unsigned long fit_misses;      /* searches that found nothing */
+    unsigned long splits;          /* placements that split off a free remainder */
+    unsigned long coalesce[4];     /* frees merging with none/prev/next/both */
+    unsigned long grows;           /* grow_heap calls */
+    unsigned long grow_bytes;      /* ... and the bytes they added */
+    unsigned long trims;           /* heap trims */
+    unsigned long quick_hits;      /* mallocs served by a quick bin */
+    unsigned long sweeps;          /* quick bin sweeps (deferred coalescing) */
+} mm_stats_t;
+
+extern int mm_stats(mm_stats_t *stats);
+
+/* 
+ * A snapshot of the whole heap, taken by walking every arena's blocks.
+ * Slab slots count as allocated blocks of their slot size; the rest of
+ * each slab page is reported as slab_idle.
+ */
+#define MM_FRAG_BINS 16 /* free block size bins: [2^(i+4), 2^(i+5)), last open */
+
+typedef struct {
+    unsigned long heap_bytes;     /* bytes of heap in all arenas */
+    unsigned long alloc_blocks;   /* allocated blocks (and slab slots) */
+    unsigned long alloc_bytes;    /* ... and their size, headers included */
+    unsigned long free_blocks;    /* free blocks */
+    unsigned long free_bytes;     /* ... and their total size */
+    unsigned long largest_free;   /* size of the largest free block */
+    unsigned long free_hist[MM_FRAG_BINS]; /* free blocks in each size bin */
+    unsigned long slab_pages;     /* pages carved into slab slots */
+    unsigned long slab_idle;      /* bytes of slab pages not in a used slot */
+    unsigned long mapped_blocks;  /* blocks in their own mapped region */
+    unsigned long mapped_bytes;   /* ... and the size of those regions */
+} mm_heapinfo_t;
+
+extern int mm_heapinfo(mm_heapinfo_t *info);
+
+/* 
+ * Heap consistency checker. mm_check(n) checks the next n blocks of the
+ * calling thread's arena, from where its last call stopped, so a full
+ * check can be spread over many calls at a bounded cost each: headers
+ * and footers, coalescing and prev-alloc bits, canaries, and that each
+ * free block is in its free list; at the end of each pass it checks the
+ * free list bitmaps too. mm_check(0) checks every arena in full, adding
+ * walks of all the free lists, the size tree and the quick bins. Returns
+ * 0 if the heap is consistent, or reports the first problem on stderr
+ * and returns -1.
+ */
+extern int mm_check(size_t blocks);
+
+/* mm_setopt parameters */
+#define MM_TRIM_THRESHOLD 1 /* free heap tail (bytes) that triggers mm_trim, -1 disables */
+#define MM_MMAP_THRESHOLD 2 /* request size (bytes) given its own mapped region, -1 disables */
+#define MM_FIT_POLICY     3 /* free block placement policy, one of MM_FIT_xxx */
+#define MM_FIT_BOUND      4 /* candidates MM_FIT_BOUNDED looks at before settling */
+#define MM_DEFER_COALESCE 5 /* 1 bins small frees by size, coalescing when a fit fails */
+
+/* MM_FIT_POLICY values */
+#define MM_FIT_FIRST   0 /* first block that fits */
+#define MM_FIT_NEXT    1 /* first block that fits after the previous fit */
+#define MM_FIT_BEST    2 /* smallest block that fits */
+#define MM_FIT_BOUNDED 3 /* smallest of the first MM_FIT_BOUND blocks that fit */
+#define MM_FIT_GOOD    4 /* any block of the next larger size range, O(1) */
 
 
 /* 
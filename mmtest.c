@@ -0,0 +1,226 @@
+/*
+ * mmtest.c - Regression tests of mm calls that the trace driver can't
+ *     replay, such as changing options while blocks are live.
+ *
+ * usage: mmtest     (or "make test"; build with -fsanitize=address
+ *                    to catch stray reads as well as wrong results)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+
+/* A test: returns NULL if it passed, else what went wrong */
+typedef struct {
+    char *name;
+    char *(*run)(void);
+} test_t;
+
+static char *test_map_realloc_up(void);
+static char *test_map_realloc_off(void);
+static char *test_tcache_exit(void);
+static void *cache_slots(void *arg);
+static char *test_arena_footprint(void);
+static void *alloc_one(void *arg);
+static char *test_good_fit_tail(void);
+static int filled(unsigned char *p, size_t n, int c);
+
+static test_t tests[] = {
+    {"realloc a mapped block after raising the threshold", test_map_realloc_up},
+    {"realloc a mapped block after disabling mapping", test_map_realloc_off},
+    {"free the slots cached by a thread when it exits", test_tcache_exit},
+    {"count only the used part of a thread's arena", test_arena_footprint},
+    {"good fit reuses a free heap tail of the request's size range",
+     test_good_fit_tail},
+};
+
+int main(void)
+{
+    int i, failed = 0;
+    char *err;
+
+    mem_init();
+    for (i = 0; i < (int)(sizeof(tests) / sizeof(tests[0])); i++) {
+	mem_reset_brk();
+	if (mm_init() < 0) {
+	    fprintf(stderr, "mmtest: mm_init failed\n");
+	    exit(1);
+	}
+	mm_setopt(MM_MMAP_THRESHOLD, 32*4096); /* the defaults */
+	mm_setopt(MM_FIT_POLICY, MM_FIT_FIRST);
+	err = tests[i].run();
+	printf("%s: %s\n", err ? "FAIL" : "ok", tests[i].name);
+	if (err) {
+	    printf("\t%s\n", err);
+	    failed++;
+	}
+    }
+    mem_deinit();
+    return failed ? 1 : 0;
+}
+
+/*
+ * realloc_moved - map a block, make the mmap path unreachable for its
+ *     new size with threshold, then grow it past its old mapping: it
+ *     moves into the heap, and only its old payload may be copied.
+ *     The block's region is mapped just below an inaccessible page
+ *     where the system allows, so copying too much faults.
+ */
+static char *realloc_moved(int threshold)
+{
+    size_t oldsize = 200000, newsize = 1000000;
+    size_t page = getpagesize();
+    size_t region = ((oldsize + ALIGNMENT + page - 1) / page) * page;
+    unsigned char *p;
+    char *guard;
+
+    /* leave a hole the size of the region below a guard page, which
+       the next mapping (the block's) then fills */
+    guard = mmap(NULL, region + page, PROT_NONE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (guard != MAP_FAILED)
+	munmap(guard, region);
+
+    if ((p = mm_malloc(oldsize)) == NULL)
+	return "mm_malloc failed";
+    memset(p, 0x5a, oldsize);
+    mm_setopt(MM_MMAP_THRESHOLD, threshold);
+    if ((p = mm_realloc(p, newsize)) == NULL)
+	return "mm_realloc failed";
+    if (mem_in_region(p, p))
+	return "block was not moved into the heap";
+    if (!filled(p, oldsize, 0x5a))
+	return "old payload not preserved";
+    memset(p, 0xa5, newsize);
+    mm_free(p);
+    if (guard != MAP_FAILED)
+	munmap(guard + region, page);
+    return NULL;
+}
+
+static char *test_map_realloc_up(void)
+{
+    return realloc_moved(1 << 22);
+}
+
+static char *test_map_realloc_off(void)
+{
+    return realloc_moved(-1);
+}
+
+/*
+ * filled - return 1 if the n bytes at p are all c
+ */
+static int filled(unsigned char *p, size_t n, int c)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+	if (p[i] != c)
+	    return 0;
+    return 1;
+}
+
+/*
+ * test_tcache_exit - a thread frees small blocks into its cache and
+ *     exits; the heap must then hold no allocated blocks
+ */
+static char *test_tcache_exit(void)
+{
+    mm_heapinfo_t info;
+    pthread_t tid;
+    void *err;
+
+    if ((pthread_create(&tid, NULL, cache_slots, NULL) != 0) ||
+	(pthread_join(tid, &err) != 0))
+	return "could not run the thread";
+    if (err != NULL)
+	return err;
+    if (mm_heapinfo(&info) < 0)
+	return "mm_heapinfo failed";
+    if (info.alloc_blocks != 0)
+	return "slots of the exited thread are still allocated";
+    return NULL;
+}
+
+/*
+ * cache_slots - allocate and free a few small blocks of each slab size
+ */
+static void *cache_slots(void *arg)
+{
+    void *p[8];
+    size_t size;
+    int i;
+
+    for (size = 8; size <= 128; size += 8) {
+	for (i = 0; i < 8; i++)
+	    if ((p[i] = mm_malloc(size)) == NULL)
+		return "mm_malloc failed";
+	for (i = 0; i < 8; i++)
+	    mm_free(p[i]);
+    }
+    return arg;
+}
+
+/*
+ * test_arena_footprint - a second thread gets an arena of its own; a
+ *     small block in it must not count the whole arena region as mapped
+ */
+static char *test_arena_footprint(void)
+{
+    pthread_t tid;
+    void *err;
+
+    if (mm_malloc(1000) == NULL) /* the main thread takes the sbrk heap */
+	return "mm_malloc failed";
+    if ((pthread_create(&tid, NULL, alloc_one, NULL) != 0) ||
+	(pthread_join(tid, &err) != 0))
+	return "could not run the thread";
+    if (err != NULL)
+	return err;
+    if (mem_mapsize() == 0)
+	return "the thread did not get a mapped arena";
+    if (mem_peaksize() > mem_heapsize() + (1 << 20))
+	return "the arena region counts towards the footprint";
+    return NULL;
+}
+
+/*
+ * alloc_one - allocate one heap block in the calling thread's arena
+ */
+static void *alloc_one(void *arg)
+{
+    if (mm_malloc(1000) == NULL)
+	return "mm_malloc failed";
+    return arg;
+}
+
+/*
+ * test_good_fit_tail - free a block at the end of the heap, then ask
+ *     good fit for a smaller one from the same size range: no larger
+ *     range has a block, so it must fall back to the free tail rather
+ *     than grow the heap by a shortfall the tail already covers
+ */
+static char *test_good_fit_tail(void)
+{
+    void *p;
+    size_t heapsize;
+
+    mm_setopt(MM_FIT_POLICY, MM_FIT_GOOD);
+    if ((p = mm_malloc(1068)) == NULL)
+	return "mm_malloc failed";
+    mm_free(p);
+    heapsize = mem_heapsize();
+    if ((p = mm_malloc(1036)) == NULL)
+	return "mm_malloc failed";
+    if (mem_heapsize() != heapsize)
+	return "the heap grew although its free tail fits";
+    mm_free(p);
+    return NULL;
+}
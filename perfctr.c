@@ -0,0 +1,103 @@
+/*
+ * perfctr.c - Hardware event counters, via Linux perf_event_open
+ *
+ * Each event gets a counter of its own rather than joining a group, so
+ * the kernel can multiplex them if there are fewer hardware counters
+ * than events; the counts are then scaled up by the fraction of the
+ * run that each counter was actually counting. Only user-mode events
+ * are counted, which the default perf_event_paranoid setting allows.
+ * Elsewhere, or if the kernel or the CPU lacks an event, that event
+ * just isn't counted.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* Cache event configs: cache id | op << 8 | result << 16 */
+#define CACHE_MISS(id) \
+    ((id) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static struct {
+    unsigned type;
+    unsigned long long config;
+} events[PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+#endif
+
+char *perf_names[PERF_EVENTS] = {"cyc", "ins", "L1m", "LLCm", "TLBm", "brm"};
+
+static int fds[PERF_EVENTS] = {-1, -1, -1, -1, -1, -1};
+
+/*
+ * perf_init - open a disabled counter for each event, for the calling
+ *     thread on any CPU
+ */
+int perf_init(void)
+{
+    int i, n = 0;
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    for (i = 0; i < PERF_EVENTS; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | 
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] >= 0)
+	    n++;
+    }
+#endif
+    return n;
+}
+
+/*
+ * perf_count - count the events of one run of f(argp)
+ */
+void perf_count(perf_test_funct f, void *argp, double *counts)
+{
+    int i;
+#ifdef __linux__
+    unsigned long long val[3]; /* count, time enabled, time running */
+
+    for (i = 0; i < PERF_EVENTS; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+    for (i = 0; i < PERF_EVENTS; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    f(argp);
+    for (i = 0; i < PERF_EVENTS; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PERF_EVENTS; i++) {
+	counts[i] = -1;
+	if ((fds[i] < 0) || (read(fds[i], val, sizeof(val)) != sizeof(val)) ||
+	    (val[2] == 0))
+	    continue;
+	counts[i] = (double)val[0] * val[1] / val[2];
+    }
+#else
+    f(argp);
+    for (i = 0; i < PERF_EVENTS; i++)
+	counts[i] = -1;
+#endif
+}
@@ -0,0 +1,25 @@
+/* 
+ * perfctr.h - Count hardware events (cache misses and the like) over
+ *     a run of a test function, with Linux perf_event_open
+ */
+
+/* The events counted, in the order perf_names gives them */
+#define PERF_CYCLES       0
+#define PERF_INSTRUCTIONS 1
+#define PERF_L1D_MISSES   2
+#define PERF_LLC_MISSES   3
+#define PERF_DTLB_MISSES  4
+#define PERF_BRANCH_MISSES 5
+#define PERF_EVENTS       6
+
+typedef void (*perf_test_funct)(void *);
+
+/* Short names of the events, for table headings */
+extern char *perf_names[PERF_EVENTS];
+
+/* Open a counter for each event; return how many could be opened */
+int perf_init(void);
+
+/* Count the events of one run of f(argp) by the calling thread.
+   counts[i] is negative if event i can't be counted on this box */
+void perf_count(perf_test_funct f, void *argp, double *counts);
@@ -0,0 +1,158 @@
+/*
+ * rep2bin.c - Convert a text (.rep) trace file to the binary format
+ *     described in trace.h, which mdriver can map instead of parse.
+ *
+ * usage: rep2bin [-p] <in.rep> <out.bin>
+ *     -p   Pack the op stream with varints (smaller, but decoded on load)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+static void usage(void);
+static void rep_error(char *path, char *msg);
+static void write_op(FILE *fp, traceop_t *op, int packed,
+		     unsigned long long *oplen);
+static void write_varint(FILE *fp, unsigned val, unsigned long long *oplen);
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    bintrace_hdr_t hdr;
+    traceop_t op;
+    char type[MAXLINE];
+    unsigned index, size;
+    int packed = 0;
+    int c, n;
+
+    while ((c = getopt(argc, argv, "ph")) != EOF) {
+	switch (c) {
+	case 'p':
+	    packed = 1;
+	    break;
+	case 'h':
+	default:
+	    usage();
+	    exit(c == 'h' ? 0 : 1);
+	}
+    }
+    if (argc - optind != 2) {
+	usage();
+	exit(1);
+    }
+
+    if ((in = fopen(argv[optind], "r")) == NULL) {
+	perror(argv[optind]);
+	exit(1);
+    }
+    if ((out = fopen(argv[optind+1], "w")) == NULL) {
+	perror(argv[optind+1]);
+	exit(1);
+    }
+
+    /* Read the text header */
+    memset(&hdr, 0, sizeof(hdr));
+    if (fscanf(in, "%d %d %d %d", &hdr.sugg_heapsize, &hdr.num_ids,
+	       &hdr.num_ops, &hdr.weight) != 4)
+	rep_error(argv[optind], "bad header");
+    hdr.magic = BT_MAGIC;
+    hdr.version = BT_VERSION;
+    hdr.flags = packed ? BT_PACKED : 0;
+
+    /* Leave room for the header, which we rewrite once oplen is known */
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) {
+	perror(argv[optind+1]);
+	exit(1);
+    }
+
+    /* Translate every request line */
+    n = 0;
+    while (fscanf(in, "%s", type) != EOF) {
+	memset(&op, 0, sizeof(op));
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    if (fscanf(in, "%u %u", &index, &size) != 2)
+		rep_error(argv[optind], "bad alloc/realloc");
+	    op.type = (type[0] == 'a') ? ALLOC : REALLOC;
+	    op.size = size;
+	    break;
+	case 'f':
+	    if (fscanf(in, "%u", &index) != 1)
+		rep_error(argv[optind], "bad free");
+	    op.type = FREE;
+	    break;
+	default:
+	    rep_error(argv[optind], "bogus type character");
+	}
+	if (index >= hdr.num_ids)
+	    rep_error(argv[optind], "id out of range");
+	op.index = index;
+	write_op(out, &op, packed, &hdr.oplen);
+	n++;
+    }
+    if (n != hdr.num_ops)
+	rep_error(argv[optind], "op count does not match header");
+
+    rewind(out);
+    if ((fwrite(&hdr, sizeof(hdr), 1, out) != 1) || (fclose(out) != 0)) {
+	perror(argv[optind+1]);
+	exit(1);
+    }
+    fclose(in);
+    return 0;
+}
+
+/*
+ * write_op - append one op to the op stream, adding its length to *oplen
+ */
+static void write_op(FILE *fp, traceop_t *op, int packed,
+		     unsigned long long *oplen)
+{
+    if (!packed) {
+	fwrite(op, sizeof(*op), 1, fp);
+	*oplen += sizeof(*op);
+	return;
+    }
+    fputc(op->type, fp);
+    (*oplen)++;
+    write_varint(fp, op->index, oplen);
+    if (op->type != FREE)
+	write_varint(fp, op->size, oplen);
+}
+
+/*
+ * write_varint - append val as a LEB128 varint, 7 bits per byte
+ */
+static void write_varint(FILE *fp, unsigned val, unsigned long long *oplen)
+{
+    while (val >= 0x80) {
+	fputc((val & 0x7f) | 0x80, fp);
+	(*oplen)++;
+	val >>= 7;
+    }
+    fputc(val, fp);
+    (*oplen)++;
+}
+
+/*
+ * rep_error - report a malformed input trace and bail out
+ */
+static void rep_error(char *path, char *msg)
+{
+    fprintf(stderr, "rep2bin: %s: %s\n", path, msg);
+    exit(1);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: rep2bin [-p] <in.rep> <out.bin>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-p         Pack the op stream with varints.\n");
+}
@@ -0,0 +1,42 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - Binary trace file format shared by mdriver and rep2bin
+ *
+ * A binary trace is a fixed bintrace_hdr_t followed by the op stream.
+ * Unless BT_PACKED is set in flags, the op stream is num_ops traceop_t
+ * records in host byte order, so mdriver can mmap the file and use the
+ * stream directly as its ops array. With BT_PACKED each op is instead
+ * a type byte followed by LEB128 varints for its index and (for allocs
+ * and reallocs) its size, which is typically a third of the size; such
+ * traces are decoded into memory when they are read.
+ */
+
+#define BT_MAGIC   0x4352544d  /* "MTRC" in a little-endian file */
+#define BT_VERSION 2
+
+/* Flags for bintrace_hdr_t */
+#define BT_PACKED  0x1         /* op stream is varint packed */
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    int index;                        /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* The fixed header at the start of a binary trace file */
+typedef struct {
+    unsigned magic;      /* BT_MAGIC */
+    unsigned version;    /* BT_VERSION */
+    unsigned flags;      /* BT_xxx flags */
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    unsigned pad;        /* zero; keeps oplen 8-byte aligned */
+    unsigned long long oplen; /* byte length of the op stream */
+} bintrace_hdr_t;
+
+#endif /* __TRACE_H_ */
@@ -0,0 +1,527 @@
+/*
+ * tracegen.c - Generate a synthetic trace, as a text (.rep) file or in
+ *     the binary format described in trace.h, from a workload model.
+ *
+ * The model replays nallocs allocations, one per step. Each block gets
+ * a size from the size distribution and a lifetime (in allocations)
+ * from the lifetime distribution, scaled so that its mean is the live
+ * set target; by Little's law about that many blocks are then live at
+ * any time once the trace has warmed up. A block is freed at the first
+ * step after its lifetime runs out, and whatever is still live at the
+ * end is freed, so every trace is balanced. Before each allocation a
+ * random live block may also be reallocated, growing by the realloc
+ * factor. Ids are recycled as blocks are freed, so the trace needs
+ * only about as many ids as there are live blocks.
+ *
+ * usage: tracegen [-bp] [-P <preset>] [-n <allocs>] [-l <live>]
+ *                 [-s <sizes>] [-L <lifetimes>] [-r <prob>:<factor>]
+ *                 [-S <seed>] <out>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "trace.h"
+
+#define MAXLINE  1024      /* max string size */
+#define MAX_SIZE (1 << 24) /* largest block a realloc may grow to */
+
+/* Kinds of size and lifetime distribution */
+enum {SZ_POW, SZ_BI, SZ_UNI, SZ_HIST};
+enum {LT_EXP, LT_POW, LT_FIXED};
+
+/* A workload model, all that's needed to generate one trace */
+typedef struct {
+    char *name;          /* preset name */
+    long nallocs;        /* number of allocations */
+    long live;           /* live set target = mean lifetime (allocations) */
+    char *sizes;         /* size distribution, see usage */
+    char *lifetimes;     /* lifetime distribution, see usage */
+    double rprob;        /* chance of a realloc before each allocation */
+    double rfactor;      /* ... and how much it grows the block */
+} model_t;
+
+/*
+ * The preset suite, run by "make scaling" and mdriver -X. The scale-xx
+ * presets keep one workload and grow the live set tenfold each time.
+ */
+static model_t presets[] = {
+    {"scale-10k",   100000,   10000,    "pow:1.5:16:4096", "exp",     0,   1},
+    {"scale-100k",  1000000,  100000,   "pow:1.5:16:4096", "exp",     0,   1},
+    {"scale-1m",    4000000,  1000000,  "pow:1.5:16:1024", "exp",     0,   1},
+    {"scale-10m",   20000000, 10000000, "pow:2:8:256",     "exp",     0,   1},
+    {"bimodal-500k", 2000000, 500000,   "bi:32:2048:0.9",  "pow:1.5", 0,   1},
+    {"realloc-100k", 1000000, 100000,   "pow:1.5:16:4096", "exp",     0.5, 2},
+    {NULL}
+};
+
+/* Parsed size distribution */
+static int sz_kind;
+static double sz_a, sz_lo, sz_hi, sz_p;  /* parameters of pow, bi, uni */
+static unsigned *hist_size;              /* histogram bins... */
+static double *hist_cum;                 /* ... and their cumulative weights */
+static int hist_n;
+
+/* Parsed lifetime distribution */
+static int lt_kind;
+static double lt_a;
+
+/* Generator state: blocks live now, ordered by death in a binary heap */
+typedef struct {
+    unsigned long long death;  /* step at which the block is freed */
+    unsigned id;
+} death_t;
+
+static death_t *deaths;     /* heap of live blocks, soonest death first */
+static long ndeaths;
+static unsigned *sizes;     /* size of each id's block */
+static unsigned *livepos;   /* position of each id in live */
+static unsigned *live;      /* ids of the live blocks, in no order */
+static unsigned *freeids;   /* stack of ids not in use */
+static long nlive, nfree, nids, cap;
+
+static unsigned long long rng_state = 1;
+
+static void usage(void);
+static void gen_error(char *msg);
+static double uniform(void);
+static void parse_sizes(char *spec);
+static void parse_lifetimes(char *spec);
+static void read_hist(char *path);
+static unsigned draw_size(void);
+static unsigned long long draw_lifetime(double mean);
+static void grow(void);
+static void push_death(unsigned long long death, unsigned id);
+static unsigned pop_death(void);
+static void emit(FILE *fp, int type, unsigned id, unsigned size,
+		 int binary, int packed, bintrace_hdr_t *hdr);
+static void write_varint(FILE *fp, unsigned val, unsigned long long *oplen);
+
+int main(int argc, char **argv)
+{
+    model_t m = {"custom", 100000, 10000, "pow:1.5:16:4096", "exp", 0, 1};
+    bintrace_hdr_t hdr;
+    model_t *p;
+    FILE *fp;
+    unsigned long long step;
+    unsigned long long peak = 0, total = 0;
+    unsigned id, size;
+    double x;
+    int binary = 0, packed = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "bpP:n:l:s:L:r:S:h")) != EOF) {
+	switch (c) {
+	case 'b':
+	    binary = 1;
+	    break;
+	case 'p':
+	    binary = packed = 1;
+	    break;
+	case 'P':
+	    for (p = presets; p->name != NULL; p++)
+		if (!strcmp(p->name, optarg))
+		    break;
+	    if (p->name == NULL) {
+		usage();
+		exit(1);
+	    }
+	    m = *p;
+	    break;
+	case 'n':
+	    m.nallocs = atol(optarg);
+	    break;
+	case 'l':
+	    m.live = atol(optarg);
+	    break;
+	case 's':
+	    m.sizes = optarg;
+	    break;
+	case 'L':
+	    m.lifetimes = optarg;
+	    break;
+	case 'r':
+	    if ((sscanf(optarg, "%lf:%lf", &m.rprob, &m.rfactor) != 2) ||
+		(m.rprob < 0) || (m.rprob > 1) || (m.rfactor <= 0))
+		gen_error("bad realloc spec");
+	    break;
+	case 'S':
+	    rng_state = strtoull(optarg, NULL, 0);
+	    break;
+	case 'h':
+	default:
+	    usage();
+	    exit(c == 'h' ? 0 : 1);
+	}
+    }
+    if (argc - optind != 1) {
+	usage();
+	exit(1);
+    }
+    if ((m.nallocs < 1) || (m.live < 1))
+	gen_error("allocation count and live set target must be positive");
+    if (rng_state == 0)
+	rng_state = 1;  /* xorshift sticks at zero */
+    parse_sizes(m.sizes);
+    parse_lifetimes(m.lifetimes);
+
+    if ((fp = fopen(argv[optind], "w")) == NULL) {
+	perror(argv[optind]);
+	exit(1);
+    }
+
+    /* Leave room for the header, which we rewrite once the counts are known */
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = BT_MAGIC;
+    hdr.version = BT_VERSION;
+    hdr.flags = packed ? BT_PACKED : 0;
+    hdr.weight = 1;
+    if (binary)
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+    else
+	fprintf(fp, "%10d\n%10d\n%10d\n%10d\n", 0, 0, 0, 0);
+
+    for (step = 0; step < (unsigned long long)m.nallocs; step++) {
+	/* Free the blocks whose lifetime has run out */
+	while ((ndeaths > 0) && (deaths[0].death <= step)) {
+	    id = pop_death();
+	    total -= sizes[id];
+	    emit(fp, FREE, id, 0, binary, packed, &hdr);
+	}
+
+	/* Maybe grow a random live block */
+	if ((nlive > 0) && (m.rprob > 0) && (uniform() < m.rprob)) {
+	    id = live[(long)(uniform() * nlive)];
+	    x = ceil(sizes[id] * m.rfactor);
+	    size = (x > MAX_SIZE) ? MAX_SIZE : (x < 1) ? 1 : (unsigned)x;
+	    total = total + size - sizes[id];
+	    sizes[id] = size;
+	    if (total > peak)
+		peak = total;
+	    emit(fp, REALLOC, id, size, binary, packed, &hdr);
+	}
+
+	/* Allocate the next block */
+	if (nfree == 0)
+	    grow();
+	id = freeids[--nfree];
+	sizes[id] = draw_size();
+	livepos[id] = nlive;
+	live[nlive++] = id;
+	push_death(step + draw_lifetime(m.live), id);
+	total += sizes[id];
+	if (total > peak)
+	    peak = total;
+	emit(fp, ALLOC, id, sizes[id], binary, packed, &hdr);
+    }
+
+    /* Free whatever is left, in order of death */
+    while (ndeaths > 0)
+	emit(fp, FREE, pop_death(), 0, binary, packed, &hdr);
+
+    hdr.sugg_heapsize = (peak > 0x7fffffff) ? 0x7fffffff : (int)peak;
+    hdr.num_ids = nids;
+    rewind(fp);
+    if (binary)
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+    else
+	fprintf(fp, "%10d\n%10d\n%10d\n%10d\n", hdr.sugg_heapsize, hdr.num_ids,
+		hdr.num_ops, hdr.weight);
+    if (fclose(fp) != 0) {
+	perror(argv[optind]);
+	exit(1);
+    }
+    return 0;
+}
+
+/*
+ * uniform - a uniform random number in [0, 1), from a xorshift64*
+ *     generator so a seed gives the same trace on every platform
+ */
+static double uniform(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * parse_sizes - parse a size distribution spec (see usage)
+ */
+static void parse_sizes(char *spec)
+{
+    if (sscanf(spec, "pow:%lf:%lf:%lf", &sz_a, &sz_lo, &sz_hi) == 3) {
+	sz_kind = SZ_POW;
+	if ((sz_a <= 0) || (sz_lo < 1) || (sz_hi < sz_lo))
+	    gen_error("bad power-law size spec");
+    }
+    else if (sscanf(spec, "bi:%lf:%lf:%lf", &sz_lo, &sz_hi, &sz_p) == 3) {
+	sz_kind = SZ_BI;
+	if ((sz_lo < 1) || (sz_hi < 1) || (sz_p < 0) || (sz_p > 1))
+	    gen_error("bad bimodal size spec");
+    }
+    else if (sscanf(spec, "uni:%lf:%lf", &sz_lo, &sz_hi) == 2) {
+	sz_kind = SZ_UNI;
+	if ((sz_lo < 1) || (sz_hi < sz_lo))
+	    gen_error("bad uniform size spec");
+    }
+    else if (!strncmp(spec, "hist:", 5)) {
+	sz_kind = SZ_HIST;
+	read_hist(spec + 5);
+    }
+    else
+	gen_error("unknown size distribution");
+}
+
+/*
+ * parse_lifetimes - parse a lifetime distribution spec (see usage)
+ */
+static void parse_lifetimes(char *spec)
+{
+    if (!strcmp(spec, "exp"))
+	lt_kind = LT_EXP;
+    else if (!strcmp(spec, "fixed"))
+	lt_kind = LT_FIXED;
+    else if (sscanf(spec, "pow:%lf", &lt_a) == 1) {
+	lt_kind = LT_POW;
+	if (lt_a <= 1)
+	    gen_error("power-law lifetimes need a shape above 1 for a mean");
+    }
+    else
+	gen_error("unknown lifetime distribution");
+}
+
+/*
+ * read_hist - read an empirical size histogram: one "<size> <weight>"
+ *     pair per line, # starts a comment
+ */
+static void read_hist(char *path)
+{
+    FILE *fp;
+    char line[MAXLINE];
+    unsigned size;
+    double weight, sum = 0;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	perror(path);
+	exit(1);
+    }
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	if ((line[0] == '#') || (sscanf(line, "%u %lf", &size, &weight) != 2))
+	    continue;
+	if ((size < 1) || (weight < 0))
+	    gen_error("bad histogram bin");
+	if (((hist_size = realloc(hist_size, (hist_n+1) * sizeof(unsigned))) == NULL) ||
+	    ((hist_cum = realloc(hist_cum, (hist_n+1) * sizeof(double))) == NULL))
+	    gen_error("out of memory");
+	sum += weight;
+	hist_size[hist_n] = size;
+	hist_cum[hist_n++] = sum;
+    }
+    fclose(fp);
+    if ((hist_n == 0) || (sum <= 0))
+	gen_error("empty histogram");
+}
+
+/*
+ * draw_size - a block size from the size distribution
+ */
+static unsigned draw_size(void)
+{
+    double u = uniform(), x;
+    int lo, hi, mid;
+
+    switch (sz_kind) {
+    case SZ_POW:  /* bounded Pareto, by inverting its CDF */
+	x = pow(pow(sz_lo, -sz_a) - u * (pow(sz_lo, -sz_a) - pow(sz_hi, -sz_a)),
+		-1 / sz_a);
+	break;
+    case SZ_BI:
+	x = (u < sz_p) ? sz_lo : sz_hi;
+	break;
+    case SZ_UNI:
+	x = sz_lo + u * (sz_hi - sz_lo + 1);
+	break;
+    default:  /* first bin whose cumulative weight passes u */
+	u *= hist_cum[hist_n-1];
+	for (lo = 0, hi = hist_n-1; lo < hi; ) {
+	    mid = (lo + hi) / 2;
+	    if (hist_cum[mid] <= u)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	return hist_size[lo];
+    }
+    return (x < 1) ? 1 : (unsigned)x;
+}
+
+/*
+ * draw_lifetime - a lifetime in allocations, at least 1, from the
+ *     lifetime distribution scaled to the given mean
+ */
+static unsigned long long draw_lifetime(double mean)
+{
+    double u = 1 - uniform(), x;  /* in (0, 1] */
+
+    switch (lt_kind) {
+    case LT_EXP:
+	x = -mean * log(u);
+	break;
+    case LT_POW:  /* Pareto with the given mean */
+	x = mean * (lt_a - 1) / lt_a * pow(u, -1 / lt_a);
+	break;
+    default:
+	x = mean;
+    }
+    if (x > 1e18)
+	x = 1e18;
+    return (x < 1) ? 1 : (unsigned long long)x;
+}
+
+/*
+ * grow - double the generator's per-id tables, adding the new ids to
+ *     the free id stack
+ */
+static void grow(void)
+{
+    long i, ncap = cap ? 2*cap : 1024;
+
+    if (((deaths = realloc(deaths, ncap * sizeof(death_t))) == NULL) ||
+	((sizes = realloc(sizes, ncap * sizeof(unsigned))) == NULL) ||
+	((livepos = realloc(livepos, ncap * sizeof(unsigned))) == NULL) ||
+	((live = realloc(live, ncap * sizeof(unsigned))) == NULL) ||
+	((freeids = realloc(freeids, ncap * sizeof(unsigned))) == NULL))
+	gen_error("out of memory");
+    for (i = ncap - 1; i >= cap; i--)
+	freeids[nfree++] = i;  /* lowest id on top */
+    cap = ncap;
+}
+
+/*
+ * push_death - add a live block to the death heap
+ */
+static void push_death(unsigned long long death, unsigned id)
+{
+    long i = ndeaths++, parent;
+
+    if (id >= nids)
+	nids = id + 1;
+    for (; i > 0; i = parent) {
+	parent = (i - 1) / 2;
+	if (deaths[parent].death <= death)
+	    break;
+	deaths[i] = deaths[parent];
+    }
+    deaths[i].death = death;
+    deaths[i].id = id;
+}
+
+/*
+ * pop_death - take the block that dies first off the death heap and
+ *     out of the live set, returning its id to the free stack
+ */
+static unsigned pop_death(void)
+{
+    unsigned id = deaths[0].id, last;
+    death_t d = deaths[--ndeaths];
+    long i = 0, child;
+
+    for (; (child = 2*i + 1) < ndeaths; i = child) {
+	if ((child + 1 < ndeaths) && (deaths[child+1].death < deaths[child].death))
+	    child++;
+	if (d.death <= deaths[child].death)
+	    break;
+	deaths[i] = deaths[child];
+    }
+    deaths[i] = d;
+
+    last = live[--nlive];
+    live[livepos[id]] = last;
+    livepos[last] = livepos[id];
+    freeids[nfree++] = id;
+    return id;
+}
+
+/*
+ * emit - append one op to the trace, in text or in binary
+ */
+static void emit(FILE *fp, int type, unsigned id, unsigned size,
+		 int binary, int packed, bintrace_hdr_t *hdr)
+{
+    traceop_t op;
+
+    hdr->num_ops++;
+    if (!binary) {
+	if (type == FREE)
+	    fprintf(fp, "f %u\n", id);
+	else
+	    fprintf(fp, "%c %u %u\n", (type == ALLOC) ? 'a' : 'r', id, size);
+	return;
+    }
+    if (!packed) {
+	memset(&op, 0, sizeof(op));
+	op.type = type;
+	op.index = id;
+	op.size = size;
+	fwrite(&op, sizeof(op), 1, fp);
+	hdr->oplen += sizeof(op);
+	return;
+    }
+    fputc(type, fp);
+    hdr->oplen++;
+    write_varint(fp, id, &hdr->oplen);
+    if (type != FREE)
+	write_varint(fp, size, &hdr->oplen);
+}
+
+/*
+ * write_varint - append val as a LEB128 varint, 7 bits per byte
+ */
+static void write_varint(FILE *fp, unsigned val, unsigned long long *oplen)
+{
+    while (val >= 0x80) {
+	fputc((val & 0x7f) | 0x80, fp);
+	(*oplen)++;
+	val >>= 7;
+    }
+    fputc(val, fp);
+    (*oplen)++;
+}
+
+/*
+ * gen_error - report a bad model and bail out
+ */
+static void gen_error(char *msg)
+{
+    fprintf(stderr, "tracegen: %s\n", msg);
+    exit(1);
+}
+
+static void usage(void)
+{
+    model_t *p;
+
+    fprintf(stderr, "Usage: tracegen [-bp] [-P <preset>] [-n <allocs>] [-l <live>] [-s <sizes>]\n");
+    fprintf(stderr, "                [-L <lifetimes>] [-r <prob>:<factor>] [-S <seed>] <out>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Write a binary trace instead of a .rep file.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-l <live>  Live set target, the mean block lifetime in allocations.\n");
+    fprintf(stderr, "\t-L <dist>  Lifetimes: exp, pow:<shape> (above 1) or fixed.\n");
+    fprintf(stderr, "\t-n <n>     Number of allocations.\n");
+    fprintf(stderr, "\t-p         Write a packed binary trace.\n");
+    fprintf(stderr, "\t-P <name>  Start from a preset, which other flags then modify.\n");
+    fprintf(stderr, "\t-r <p>:<f> Before each allocation, with chance <p> grow a random\n");
+    fprintf(stderr, "\t           live block <f> times by realloc.\n");
+    fprintf(stderr, "\t-s <dist>  Sizes: pow:<shape>:<min>:<max>, bi:<s1>:<s2>:<p1>,\n");
+    fprintf(stderr, "\t           uni:<min>:<max> or hist:<file> (\"<size> <weight>\" lines).\n");
+    fprintf(stderr, "\t-S <seed>  Random seed.\n");
+    fprintf(stderr, "Presets\n");
+    for (p = presets; p->name != NULL; p++)
+	fprintf(stderr, "\t%-13s %ld allocs, %ld live, sizes %s, lifetimes %s\n",
+		p->name, p->nallocs, p->live, p->sizes, p->lifetimes);
+}